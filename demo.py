@@ -57,8 +57,7 @@ class MainWindow(QMainWindow):
         self.plotLayout.addWidget(self.livewidget)
         self.livewidget.setAxisLabels('detectors', 'time channels')
 
-        x = open("testdata/testdata.npy").read()[80:]
-        data = LWData(1024, 1024, 1, "<u4", x)
+        data = LWData("testdata/testdata.npy")
         self.livewidget.setData(data)
         # self.livewidget.setLog10(True)
         self.livewidget.setKeepAspect(True)
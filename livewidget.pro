@@ -4,6 +4,18 @@ INCLUDEPATH += . /usr/include/qwt5 /usr/include/qwt-qt4 /usr/include/qwt /usr/in
 
 LIBS += -lqwt-qt4 -lcfitsio -ltiff
 
+# NeXus/HDF5 reader, enable with "qmake CONFIG+=hdf5"
+hdf5 {
+    DEFINES += HAVE_HDF5
+    # Debian and Ubuntu install the serial HDF5 library under its own name
+    exists(/usr/include/hdf5/serial/hdf5.h) {
+        INCLUDEPATH += /usr/include/hdf5/serial
+        LIBS += -lhdf5_serial
+    } else {
+        LIBS += -lhdf5
+    }
+}
+
 TARGET = livewidget
 
 HEADERS += \
@@ -14,7 +26,17 @@ HEADERS += \
     lw_histogram.h \
     lw_data.h \
     lw_profile.h \
-    lw_imageproc.h
+    lw_imageproc.h \
+    lw_storage.h \
+    lw_hdf5.h \
+    lw_fits.h \
+    lw_parallel.h \
+    lw_spectrogram.h \
+    lw_pyramid.h \
+    lw_export.h \
+    lw_contour.h \
+    lw_roi.h \
+    lw_integrate.h
 
 SOURCES += \
     lw_widget.cpp \
@@ -24,4 +46,13 @@ SOURCES += \
     lw_data.cpp \
     lw_profile.cpp \
     lw_main.cpp \
-    lw_imageproc.cpp
+    lw_imageproc.cpp \
+    lw_storage.cpp \
+    lw_hdf5.cpp \
+    lw_fits.cpp \
+    lw_spectrogram.cpp \
+    lw_pyramid.cpp \
+    lw_export.cpp \
+    lw_contour.cpp \
+    lw_roi.cpp \
+    lw_integrate.cpp
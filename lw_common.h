@@ -33,6 +33,8 @@ enum LWFiletype {
     TYPE_FITS               = 2,
     TYPE_TOFTOF             = 3,
     TYPE_TIFF               = 4,
+    TYPE_NPY                = 5,
+    TYPE_HDF5               = 6,
     TYPE_RAW                = 254,
 };
 
@@ -50,7 +52,8 @@ enum LWCtrl {
     Normalize               = 0x0400,
     Darkfield               = 0x0800,
     ShowGrid                = 0x1000,
-    Filelist                = 0x2000
+    Filelist                = 0x2000,
+    Rois                    = 0x4000
 };
 
 enum LWImageFilters {
@@ -73,4 +76,34 @@ enum LWImageOperations {
     StackMaximum            = 9
 };
 
+enum LWPyramidMode {
+    PyramidOff              = 0,
+    PyramidMax              = 1,
+    PyramidMean             = 2
+};
+
+enum LWRoiType {
+    RoiRect                 = 0,
+    RoiLine                 = 1,
+    RoiPolygon              = 2
+};
+
+enum LWInterpolation {
+    InterpolationArea       = 0,
+    InterpolationBilinear   = 1,
+    InterpolationBicubic    = 2,
+    InterpolationLanczos    = 3
+};
+
+enum LWIntegrationMode {
+    IntegrateRadial         = 0,
+    IntegrateAzimuthal      = 1
+};
+
+enum LWFitsCompression {
+    FitsUncompressed        = 0,
+    FitsRiceCompressed      = 1,
+    FitsGzipCompressed      = 2
+};
+
 #endif
@@ -0,0 +1,327 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include <QMutexLocker>
+#include <QPainter>
+#include <QtConcurrentRun>
+
+#include "lw_contour.h"
+#include "lw_parallel.h"
+#include "lw_pyramid.h"
+
+
+namespace {
+
+// cell edges: 0 bottom, 1 right, 2 top, 3 left; corners: 0 bottom left,
+// then counterclockwise; the case index has a bit set for each corner
+// above the contour value
+const int s_edges[16][4] = {
+    {-1, -1, -1, -1}, { 3,  0, -1, -1}, { 0,  1, -1, -1}, { 3,  1, -1, -1},
+    { 1,  2, -1, -1}, { 3,  0,  1,  2}, { 0,  2, -1, -1}, { 3,  2, -1, -1},
+    { 2,  3, -1, -1}, { 0,  2, -1, -1}, { 0,  1,  2,  3}, { 1,  2, -1, -1},
+    { 1,  3, -1, -1}, { 0,  1, -1, -1}, { 0,  3, -1, -1}, {-1, -1, -1, -1}
+};
+
+/// Runs marching squares over a band of cell rows; cell (i, j) has the
+/// source pixels (i, j) and (i+1, j+1) as corners.
+struct ContourRows {
+    const float *values;
+    int width;
+    int scale;
+    const QVector<double> *levels;
+    QVector<QPointF> *lines;  // one vector per cell row
+    const QAtomicInt *cancel;
+
+    // position of the contour on an edge, in data coordinates
+    inline QPointF crossing(int edge, int i, int j, const float *v,
+                            double c) const {
+        static const int a[4] = {0, 1, 3, 0}, b[4] = {1, 2, 2, 3};
+        double t = (c - v[a[edge]]) / (v[b[edge]] - v[a[edge]]);
+        double x = i, y = j;
+        switch (edge) {
+        case 0: x += t; break;
+        case 1: x += 1; y += t; break;
+        case 2: x += t; y += 1; break;
+        case 3: y += t; break;
+        }
+        // source pixel values belong to the pixel centers
+        return QPointF((x + 0.5) * scale, (y + 0.5) * scale);
+    }
+
+    void operator()(int begin, int end) const {
+        for (int j = begin; j < end; ++j) {
+            if (int(*cancel))
+                return;
+            const float *row = values + (size_t)j * width;
+            QVector<QPointF> &out = lines[j];
+            for (int i = 0; i < width - 1; ++i) {
+                const float v[4] = {row[i], row[i+1], row[i+width+1], row[i+width]};
+                float lo = qMin(qMin(v[0], v[1]), qMin(v[2], v[3]));
+                float hi = qMax(qMax(v[0], v[1]), qMax(v[2], v[3]));
+                // also skips cells with NaN
+                if (!(lo < hi))
+                    continue;
+                for (int k = 0; k < levels->size(); ++k) {
+                    double c = levels->at(k);
+                    if (c < lo || c >= hi)
+                        continue;
+                    int index = (v[0] > c) | (v[1] > c) << 1 |
+                        (v[2] > c) << 2 | (v[3] > c) << 3;
+                    const int *edges = s_edges[index];
+                    // saddle: the center decides which corners are joined
+                    if ((index == 5 || index == 10) &&
+                        (v[0] + v[1] + v[2] + v[3]) / 4 > c) {
+                        static const int joined[2][4] = {{0, 1, 2, 3}, {3, 0, 1, 2}};
+                        edges = joined[index == 5 ? 0 : 1];
+                    }
+                    out.append(crossing(edges[0], i, j, v, c));
+                    out.append(crossing(edges[1], i, j, v, c));
+                    if (edges[2] >= 0) {
+                        out.append(crossing(edges[2], i, j, v, c));
+                        out.append(crossing(edges[3], i, j, v, c));
+                    }
+                }
+            }
+        }
+    }
+};
+
+/// Converts a band of source rows to displayed values.
+template <class T>
+struct ValueRows {
+    const T *source;
+    float *values;
+    int width;
+    bool log10;
+
+    void operator()(int begin, int end) const {
+        for (size_t i = (size_t)begin * width; i < (size_t)end * width; ++i) {
+            double v = (double)source[i];
+            if (log10)
+                v = (v > 0) ? ::log10(v) : -1.;
+            values[i] = (float)v;
+        }
+    }
+};
+
+template <class T>
+void convertValues(const QVector<T> &source, int width, bool log10,
+                   QVector<float> &values)
+{
+    values.resize(source.size());
+    ValueRows<T> rows;
+    rows.source = source.constData();
+    rows.values = values.data();
+    rows.width = width;
+    rows.log10 = log10;
+    lwParallelFor(source.size() / qMax(width, 1), rows);
+}
+
+}
+
+
+LWContourItem::LWContourItem(const LWSpectrogram *spectro)
+    : QObject(), QwtPlotItem(QwtText("Contours")),
+      m_spectro(spectro),
+      m_count(0),
+      m_pen(Qt::black)
+{
+    m_key.generation = 0;
+    m_key.level = -1;
+    m_key.mode = PyramidOff;
+    m_running = m_key;
+    // only once the computation has finished, so that the next draw()
+    // can start another one
+    connect(&m_watcher, SIGNAL(finished()), this, SIGNAL(contoursReady()));
+    // above the spectrogram
+    setZ(m_spectro->z() + 1);
+}
+
+LWContourItem::~LWContourItem()
+{
+    m_cancel = 1;
+    m_run.waitForFinished();
+}
+
+int LWContourItem::rtti() const
+{
+    return QwtPlotItem::Rtti_PlotUserItem + 1;
+}
+
+void LWContourItem::setContourLevels(const QVector<double> &values)
+{
+    m_values = values;
+    itemChanged();
+}
+
+void LWContourItem::setContourCount(int count)
+{
+    m_count = qMax(count, 0);
+    itemChanged();
+}
+
+void LWContourItem::setPen(const QPen &pen)
+{
+    m_pen = pen;
+    itemChanged();
+}
+
+QVector<double> LWContourItem::valuesFor(const QwtDoubleInterval &range) const
+{
+    if (!m_values.isEmpty() || m_count == 0 || !range.isValid())
+        return m_values;
+    QVector<double> values(m_count);
+    for (int k = 0; k < m_count; ++k)
+        values[k] = range.minValue() + range.width() * (k + 1) / (m_count + 1);
+    return values;
+}
+
+void LWContourItem::draw(QPainter *painter, const QwtScaleMap &xMap,
+                         const QwtScaleMap &yMap, const QRect &) const
+{
+    const LWRasterData *raster =
+        dynamic_cast<const LWRasterData *>(&m_spectro->data());
+    if (!raster || !raster->lwData()->currentLayer())
+        return;
+    const LWData *data = raster->lwData();
+
+    Key key;
+    key.generation = data->generation();
+    key.values = valuesFor(raster->range());
+    if (key.values.isEmpty())
+        return;
+
+    // contour the level the spectrogram shows, once it is built
+    QList<LWPyramidLevel> levels;
+    bool ready = true;
+    key.level = 0;
+    key.mode = PyramidOff;
+    int wanted = m_spectro->pyramidLevelFor(xMap, yMap);
+    if (wanted > 0 && m_spectro->pyramidMode() != PyramidOff) {
+        ready = data->pyramid()->request(data, m_spectro->pyramidMode(), levels);
+        key.level = qMin(wanted, levels.size());
+        key.mode = key.level > 0 ? m_spectro->pyramidMode() : PyramidOff;
+    }
+
+    QVector<QPointF> lines;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (ready && !(m_key == key)) {
+            if (!m_run.isRunning())
+                start(data, key, levels);
+            else if (!(m_running == key))
+                // finishes early and triggers another draw
+                m_cancel = 1;
+        }
+        // until then, keep showing the lines of another zoom
+        if (m_key.generation != key.generation || m_key.values != key.values)
+            return;
+        lines = m_lines;
+    }
+
+    QVector<QPointF> points(lines.size());
+    for (int k = 0; k < lines.size(); ++k)
+        points[k] = QPointF(xMap.xTransform(lines[k].x()),
+                            yMap.xTransform(lines[k].y()));
+    painter->save();
+    painter->setPen(m_pen);
+    painter->drawLines(points);
+    painter->restore();
+}
+
+void LWContourItem::start(const LWData *data, const Key &key,
+                          const QList<LWPyramidLevel> &levels) const
+{
+    // the source is snapshot, since the data may be replaced meanwhile;
+    // pyramid levels and the log image are shared, not copied
+    Job *job = new Job;
+    job->key = key;
+    job->scale = 1 << key.level;
+    job->log10 = data->isLog10();
+    if (key.level > 0) {
+        const LWPyramidLevel &level = levels[key.level - 1];
+        job->width = level.width;
+        job->height = level.height;
+        if (key.mode == PyramidMean)
+            job->floats = level.mean;
+        else
+            job->ints = level.max;
+    } else {
+        job->width = data->width();
+        job->height = data->height();
+        if (!data->logImage().isEmpty()) {
+            job->floats = data->logImage();
+            job->log10 = false;
+        } else {
+            job->ints.resize(data->width() * data->height());
+            memcpy(job->ints.data(), data->currentLayer(),
+                   sizeof(data_t) * job->ints.size());
+        }
+    }
+
+    m_running = key;
+    m_cancel = 0;
+    m_run = QtConcurrent::run(this, &LWContourItem::compute, job);
+    m_watcher.setFuture(m_run);
+}
+
+void LWContourItem::compute(Job *job) const
+{
+    QVector<float> values;
+    if (!job->ints.isEmpty())
+        convertValues(job->ints, job->width, job->log10, values);
+    else if (job->log10)
+        convertValues(job->floats, job->width, true, values);
+    else
+        values = job->floats;
+
+    std::vector<QVector<QPointF> > rows(qMax(job->height - 1, 0));
+    ContourRows contour;
+    contour.values = values.constData();
+    contour.width = job->width;
+    contour.scale = job->scale;
+    contour.levels = &job->key.values;
+    contour.lines = rows.empty() ? NULL : &rows[0];
+    contour.cancel = &m_cancel;
+    lwParallelFor(rows.size(), contour);
+
+    if (!int(m_cancel)) {
+        int count = 0;
+        for (size_t j = 0; j < rows.size(); ++j)
+            count += rows[j].size();
+        QVector<QPointF> lines(count);
+        QPointF *out = lines.data();
+        for (size_t j = 0; j < rows.size(); ++j)
+            for (int k = 0; k < rows[j].size(); ++k)
+                *out++ = rows[j][k];
+
+        QMutexLocker locker(&m_mutex);
+        m_lines = lines;
+        m_key = job->key;
+    }
+    delete job;
+}
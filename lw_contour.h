@@ -0,0 +1,120 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#ifndef LW_CONTOUR_H
+#define LW_CONTOUR_H
+
+#include <QAtomicInt>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QMutex>
+#include <QObject>
+#include <QPen>
+#include <QPointF>
+#include <QVector>
+
+#include <qwt_double_interval.h>
+#include <qwt_plot_item.h>
+#include <qwt_scale_map.h>
+
+#include "lw_common.h"
+#include "lw_data.h"
+#include "lw_spectrogram.h"
+
+
+/// Contour lines over the image of an LWSpectrogram.
+///
+/// The lines are computed with marching squares on the pyramid level the
+/// spectrogram shows at the current zoom, in the background; the lines of
+/// the last computation are kept for their data generation, level and
+/// contour values, and contoursReady() is emitted when new ones are
+/// available.  Qwt's own ContourMode is too slow for our images.
+class LWContourItem : public QObject, public QwtPlotItem
+{
+    Q_OBJECT
+
+  private:
+    struct Key {
+        int generation;
+        int level;
+        LWPyramidMode mode;
+        QVector<double> values;
+        bool operator==(const Key &other) const {
+            return generation == other.generation && level == other.level &&
+                mode == other.mode && values == other.values;
+        }
+    };
+
+    struct Job {
+        Key key;
+        int width, height;  // of the source
+        int scale;          // data pixels per source pixel
+        bool log10;
+        QVector<data_t> ints;   // either these,
+        QVector<float> floats;  // or these are filled
+    };
+
+    const LWSpectrogram *m_spectro;
+    QVector<double> m_values;
+    int m_count;
+    QPen m_pen;
+
+    mutable QMutex m_mutex;
+    mutable Key m_key;               // of m_lines
+    mutable QVector<QPointF> m_lines;  // pairs of end points, in data coordinates
+    mutable Key m_running;
+    mutable QFuture<void> m_run;
+    mutable QFutureWatcher<void> m_watcher;  // emits contoursReady()
+    mutable QAtomicInt m_cancel;
+
+    QVector<double> valuesFor(const QwtDoubleInterval &range) const;
+    void start(const LWData *data, const Key &key,
+               const QList<LWPyramidLevel> &levels) const;
+    void compute(Job *job) const;
+
+  public:
+    LWContourItem(const LWSpectrogram *spectro);
+    /// Waits for a running computation to finish.
+    virtual ~LWContourItem();
+
+    virtual int rtti() const;
+    virtual void draw(QPainter *painter, const QwtScaleMap &xMap,
+                      const QwtScaleMap &yMap, const QRect &canvasRect) const;
+
+    /// Contour at these values (in displayed units, i.e. log10 with log
+    /// display).  Overrides the count.
+    const QVector<double> &contourLevels() const { return m_values; }
+    void setContourLevels(const QVector<double> &values);
+    /// Contour at "count" values evenly spaced in the color range; 0
+    /// (default) and no levels switch the contours off.
+    int contourCount() const { return m_count; }
+    void setContourCount(int count);
+
+    const QPen &pen() const { return m_pen; }
+    void setPen(const QPen &pen);
+
+  signals:
+    void contoursReady();
+};
+
+#endif
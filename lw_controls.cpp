@@ -29,6 +29,8 @@
 #include "lw_controls.h"
 #include "lw_widget.h"
 #include "lw_imageproc.h"
+#include "lw_integrate.h"
+#include "lw_roi.h"
 
 
 LWControls::LWControls(QWidget *parent) : QWidget(parent)
@@ -40,7 +42,10 @@ LWControls::LWControls(QWidget *parent) : QWidget(parent)
 
     profLine0 = profLine1 = profLine2 = 0;
     profWindow = 0;
-    m_prof_x[0] = m_prof_x[1] = m_prof_y[0] = m_prof_y[1] = 0;
+    roiWindow = 0;
+    m_roi_picking = false;
+    m_prof_x.fill(0, 2);
+    m_prof_y.fill(0, 2);
 
     setupUi();
 }
@@ -126,7 +131,7 @@ void LWControls::setupUi()
     profLine0->setRenderHint(QwtPlotCurve::RenderAntialiased);
     profLine0->setPen(QPen(QBrush(QColor(255, 255, 255, 255)), 3,
                            Qt::SolidLine, Qt::FlatCap));
-    profLine0->setData(QwtCPointerData(m_prof_x, m_prof_y, 2));
+    profLine0->setData(QwtCPointerData(m_prof_x.constData(), m_prof_y.constData(), 2));
     profLine0->setVisible(false);
     profLine0->attach(m_widget->plot());
 
@@ -134,7 +139,7 @@ void LWControls::setupUi()
     profLine1->setRenderHint(QwtPlotCurve::RenderAntialiased);
     profLine1->setPen(QPen(QBrush(QColor(0, 255, 0, 255)), 3,
                            Qt::SolidLine, Qt::FlatCap));
-    profLine1->setData(QwtCPointerData(m_prof_x, m_prof_y, 2));
+    profLine1->setData(QwtCPointerData(m_prof_x.constData(), m_prof_y.constData(), 2));
     profLine1->setVisible(false);
     profLine1->attach(m_widget->plot());
 
@@ -142,7 +147,7 @@ void LWControls::setupUi()
     profLine2->setRenderHint(QwtPlotCurve::RenderAntialiased);
     profLine2->setPen(QPen(QBrush(QColor(0, 255, 0, 96)), 1,
                            Qt::SolidLine, Qt::FlatCap));
-    profLine2->setData(QwtCPointerData(m_prof_x, m_prof_y, 2));
+    profLine2->setData(QwtCPointerData(m_prof_x.constData(), m_prof_y.constData(), 2));
     profLine2->setVisible(false);
     profLine2->attach(m_widget->plot());
 
@@ -164,6 +169,26 @@ void LWControls::setupUi()
     hLayout->addWidget(profileBins);
     mainLayout->addLayout(hLayout);
 
+    hLayout = new QHBoxLayout();
+    profileInterpolationLabel = new QLabel("profile sampling:", this);
+    hLayout->addWidget(profileInterpolationLabel);
+    profileInterpolation = new QComboBox(this);
+    profileInterpolation->addItem("area");
+    profileInterpolation->addItem("bilinear");
+    profileInterpolation->addItem("bicubic");
+    profileInterpolation->addItem("Lanczos");
+    profileInterpolation->setEnabled(false);
+    hLayout->addWidget(profileInterpolation);
+    mainLayout->addLayout(hLayout);
+
+    hLayout = new QHBoxLayout();
+    roiButton = new QPushButton("add ROI", this);
+    roiButton->setCheckable(true);
+    hLayout->addWidget(roiButton);
+    roiTableButton = new QPushButton("show ROIs", this);
+    hLayout->addWidget(roiTableButton);
+    mainLayout->addLayout(hLayout);
+
     xsumButton = new QPushButton("integrate over x", this);
     mainLayout->addWidget(xsumButton);
     ysumButton = new QPushButton("integrate over y", this);
@@ -280,6 +305,10 @@ void LWControls::setupUi()
     knownExt.append("*.raw");
     knownExt.append("*.fits");
     knownExt.append("*.tif");
+    knownExt.append("*.npy");
+    knownExt.append("*.h5");
+    knownExt.append("*.hdf");
+    knownExt.append("*.nxs");
 
     filelistView = new QListView(this);
     filelistModel = new QFileSystemModel(this);
@@ -341,6 +370,12 @@ void LWControls::setupUi()
                      this, SLOT(updateProfWidth(int)));
     QObject::connect(profileBins, SIGNAL(valueChanged(int)),
                      this, SLOT(updateProfBins(int)));
+    QObject::connect(profileInterpolation, SIGNAL(currentIndexChanged(int)),
+                     this, SLOT(updateProfInterpolation(int)));
+    QObject::connect(roiButton, SIGNAL(released()),
+                     this, SLOT(pickRoi()));
+    QObject::connect(roiTableButton, SIGNAL(released()),
+                     this, SLOT(showRoiWindow()));
     QObject::connect(xsumButton, SIGNAL(released()),
                      this, SLOT(createXSum()));
     QObject::connect(ysumButton, SIGNAL(released()),
@@ -389,7 +424,9 @@ void LWControls::dataUpdated(LWData *data)
     ctrSlider->setValue(256 * contrast);
     m_sliderupdating = false;
 
-    if (profWindow)
+    if (profWindow && m_prof_type >= 3)
+        updateIntegration();
+    else if (profWindow)
         profWindow->update(m_widget->data(), m_prof_x, m_prof_y,
                            profileWidth->value(), profileBins->value(),
                            m_prof_type);
@@ -537,6 +574,7 @@ void LWControls::pickProfile()
 {
     if (!m_widget->data())
         return;
+    m_roi_picking = false;
     m_widget->plot()->getPicker()->setEnabled(true);
     m_widget->plot()->getZoomer()->setEnabled(false);
     profileButton->setText("click two points on image");
@@ -547,6 +585,8 @@ void LWControls::showProfWindow(const char *title)
 {
     if (profWindow == NULL)
         profWindow = new LWProfileWindow(this, m_widget);
+    profWindow->setInterpolation(
+        LWInterpolation(profileInterpolation->currentIndex()));
     profWindow->update(m_widget->data(), m_prof_x, m_prof_y,
                        profileWidth->value(), profileBins->value(),
                        m_prof_type);
@@ -556,21 +596,68 @@ void LWControls::showProfWindow(const char *title)
         profileHideButton->setEnabled(true);
         profileWidth->setEnabled(true);
         profileBins->setEnabled(true);
+        profileInterpolation->setEnabled(true);
     }
 }
 
+void LWControls::pickRoi()
+{
+    if (!m_widget->data())
+        return;
+    m_roi_picking = true;
+    m_widget->plot()->getPicker()->setEnabled(true);
+    m_widget->plot()->getZoomer()->setEnabled(false);
+    roiButton->setText("click corners on image");
+    roiButton->setChecked(true);
+}
+
+void LWControls::showRoiWindow()
+{
+    if (roiWindow == NULL)
+        roiWindow = new LWRoiWindow(this, m_widget->roiManager());
+    roiWindow->show();
+    roiWindow->raise();
+}
+
 void LWControls::createProfile(const QwtArray<QwtDoublePoint> &points)
 {
     m_widget->plot()->getPicker()->setEnabled(false);
     m_widget->plot()->getZoomer()->setEnabled(true);
+    if (m_roi_picking) {
+        m_roi_picking = false;
+        roiButton->setText("add ROI");
+        roiButton->setChecked(false);
+        // two points span a rectangle, more a polygon
+        if (points.size() < 2)
+            return;
+        if (points.size() == 2) {
+            int x = qMin(points[0].x(), points[1].x());
+            int y = qMin(points[0].y(), points[1].y());
+            m_widget->roiManager()->addRect(
+                x, y, qAbs(points[1].x() - points[0].x()),
+                qAbs(points[1].y() - points[0].y()));
+        } else {
+            QPolygonF polygon;
+            for (int i = 0; i < points.size(); ++i)
+                polygon << points[i];
+            m_widget->roiManager()->addPolygon(polygon);
+        }
+        m_widget->roiManager()->update(m_widget->data());
+        showRoiWindow();
+        return;
+    }
     profileButton->setText("plot line profile");
     profileButton->setChecked(false);
-    if (points.size() != 2)
+    // more than two points give a polyline
+    if (points.size() < 2)
         return;
-    m_prof_x[0] = points[0].x();
-    m_prof_y[0] = points[0].y();
-    m_prof_x[1] = points[1].x();
-    m_prof_y[1] = points[1].y();
+    m_prof_x.resize(points.size());
+    m_prof_y.resize(points.size());
+    for (int i = 0; i < points.size(); ++i) {
+        m_prof_x[i] = points[i].x();
+        m_prof_y[i] = points[i].y();
+    }
+    updateProfLines();
     m_prof_type = 2;
 
     profLine0->setVisible(true);
@@ -590,6 +677,7 @@ void LWControls::hideProfileLine()
     profileHideButton->setEnabled(false);
     profileWidth->setEnabled(false);
     profileBins->setEnabled(false);
+    profileInterpolation->setEnabled(false);
     m_widget->plot()->replot();
 }
 
@@ -599,10 +687,8 @@ void LWControls::createYSum()
     if (!m_widget->data())
         return;
     m_prof_type = 1;
-    m_prof_x[0] = 0;
-    m_prof_x[1] = m_widget->data()->width();
-    m_prof_y[0] = m_widget->data()->height() / 2;
-    m_prof_y[1] = m_widget->data()->height() / 2;
+    setProfilePoints(0, m_widget->data()->height() / 2,
+                     m_widget->data()->width(), m_widget->data()->height() / 2);
     profileWidth->setValue(m_widget->data()->height());
     showProfWindow("Y Integration");
 }
@@ -612,14 +698,62 @@ void LWControls::createXSum()
     if (!m_widget->data())
         return;
     m_prof_type = 0;
-    m_prof_y[0] = 0;
-    m_prof_y[1] = m_widget->data()->height();
-    m_prof_x[0] = m_widget->data()->width() / 2;
-    m_prof_x[1] = m_widget->data()->width() / 2;
+    setProfilePoints(m_widget->data()->width() / 2, 0,
+                     m_widget->data()->width() / 2, m_widget->data()->height());
     profileWidth->setValue(m_widget->data()->width());
     showProfWindow("X Integration");
 }
 
+void LWControls::updateIntegration()
+{
+    LWRadialIntegrator *integrator = m_widget->integrator();
+    profWindow->showCurve(integrator->binCenters(),
+                          integrator->integrate(m_widget->data()),
+                          m_prof_type);
+}
+
+void LWControls::showIntegration()
+{
+    if (!m_widget->data())
+        return;
+    m_prof_type = m_widget->integrator()->mode() == IntegrateRadial ? 3 : 4;
+    if (profWindow == NULL)
+        profWindow = new LWProfileWindow(this, m_widget);
+    updateIntegration();
+    profWindow->setWindowTitle(m_prof_type == 3 ? "Radial integration"
+                               : "Azimuthal integration");
+    if (m_widget->instrument() != INSTR_TOFTOF) {
+        // the profile line does not apply
+        profLine0->setVisible(false);
+        profLine1->setVisible(false);
+        profLine2->setVisible(false);
+        m_widget->plot()->replot();
+        profWindow->show();
+        profileHideButton->setEnabled(true);
+    }
+}
+
+void LWControls::setProfilePoints(double x1, double y1, double x2, double y2)
+{
+    m_prof_x.resize(2);
+    m_prof_y.resize(2);
+    m_prof_x[0] = x1;
+    m_prof_y[0] = y1;
+    m_prof_x[1] = x2;
+    m_prof_y[1] = y2;
+    updateProfLines();
+}
+
+void LWControls::updateProfLines()
+{
+    // the curves point into the vectors, which may have been reallocated
+    QwtCPointerData points(m_prof_x.constData(), m_prof_y.constData(),
+                           m_prof_x.size());
+    profLine0->setData(points);
+    profLine1->setData(points);
+    profLine2->setData(points);
+}
+
 void LWControls::zoomAdjusted()
 {
     updateProfLineWidth(profileWidth->value());
@@ -642,18 +776,28 @@ void LWControls::updateProfLineWidth(int w)
 void LWControls::updateProfWidth(int w)
 {
     updateProfLineWidth(w);
-    if (profWindow)
+    if (profWindow && m_prof_type < 3)
         profWindow->update(m_widget->data(), m_prof_x, m_prof_y, w,
                            profileBins->value(), m_prof_type);
 }
 
 void LWControls::updateProfBins(int b)
 {
-    if (profWindow)
+    if (profWindow && m_prof_type < 3)
         profWindow->update(m_widget->data(), m_prof_x, m_prof_y,
                            profileWidth->value(), b, m_prof_type);
 }
 
+void LWControls::updateProfInterpolation(int mode)
+{
+    if (profWindow && m_prof_type < 3) {
+        profWindow->setInterpolation(LWInterpolation(mode));
+        profWindow->update(m_widget->data(), m_prof_x, m_prof_y,
+                           profileWidth->value(), profileBins->value(),
+                           m_prof_type);
+    }
+}
+
 void LWControls::updateOperationSelector(int comboBoxValue)
 {
     if (m_widget->isImageOperation() != LWImageOperations(comboBoxValue))
@@ -712,6 +856,11 @@ void LWControls::setControls(LWCtrl which)
     profileBins->setVisible(which & CreateProfile);
     profileWidthLabel->setVisible(which & CreateProfile);
     profileBinsLabel->setVisible(which & CreateProfile);
+    profileInterpolation->setVisible(which & CreateProfile);
+    profileInterpolationLabel->setVisible(which & CreateProfile);
+
+    roiButton->setVisible(which & Rois);
+    roiTableButton->setVisible(which & Rois);
 
     xsumButton->setVisible(which & Integrate);
     ysumButton->setVisible(which & Integrate);
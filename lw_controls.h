@@ -44,6 +44,7 @@
 #include "qwt_plot_curve.h"
 
 class LWProfileWindow;
+class LWRoiWindow;
 
 #include "lw_widget.h"
 #include "lw_histogram.h"
@@ -68,11 +69,16 @@ class LWControls : public QWidget
     double m_histogram_x[257];
     double m_histogram_y[257];
 
-    double m_prof_x[2];
-    double m_prof_y[2];
-    int m_prof_type;
+    // points of the profile line, two or more
+    QVector<double> m_prof_x;
+    QVector<double> m_prof_y;
+    int m_prof_type;  // 3 and 4: radial and azimuthal integration
+    bool m_roi_picking;  // the picker adds a ROI instead of a profile
 
     void showProfWindow(const char *title);
+    void updateIntegration();
+    void setProfilePoints(double x1, double y1, double x2, double y2);
+    void updateProfLines();
 
   protected:
     QVBoxLayout *mainLayout;
@@ -98,6 +104,12 @@ class LWControls : public QWidget
     QLabel *profileWidthLabel;
     QSpinBox *profileBins;
     QLabel *profileBinsLabel;
+    QComboBox *profileInterpolation;
+    QLabel *profileInterpolationLabel;
+
+    QPushButton *roiButton;
+    QPushButton *roiTableButton;
+    LWRoiWindow *roiWindow;
 
     QPushButton *xsumButton;
     QPushButton *ysumButton;
@@ -154,10 +166,14 @@ class LWControls : public QWidget
     void createProfile(const QwtArray<QwtDoublePoint> &);
     void updateProfWidth(int);
     void updateProfBins(int);
+    void updateProfInterpolation(int);
     void updateProfLineWidth(int);
     void zoomAdjusted();
+    void pickRoi();
+    void showRoiWindow();
     void createXSum();
     void createYSum();
+    void showIntegration();
     void listFiles();
     void selectFile(QModelIndex);
     void model_directoryLoaded(QString);
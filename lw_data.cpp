@@ -27,20 +27,35 @@
 #include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <vector>
 #include <string>
 #include <limits>
 #include <math.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <fitsio.h>
 #include <tiffio.h>
 
 #include "lw_common.h"
 
+#include <QAtomicInt>
 #include <QStringList>
 
 #include "lw_data.h"
+#include "lw_fits.h"
+#include "lw_hdf5.h"
 #include "lw_imageproc.h"
+#include "lw_parallel.h"
+#include "lw_pyramid.h"
+#include "lw_storage.h"
+
+// source of LWData::generation(), shared so that it is unique across objects
+static QAtomicInt s_generation;
 
 #ifdef CLOCKING
 static clock_t clock_start, clock_stop;
@@ -62,6 +77,133 @@ static inline double safe_log10(double v)
     return v;
 }
 
+// log10 of small counts, which make up most of a detector image; the
+// table is filled during static initialization, before any thread runs
+#define LOG_TABLE_SIZE 4096
+struct LogTable {
+    float values[LOG_TABLE_SIZE];
+    LogTable() {
+        for (int i = 0; i < LOG_TABLE_SIZE; ++i)
+            values[i] = (float)safe_log10(i);
+    }
+};
+static const LogTable s_log_table;
+
+/// Fills a band of rows of the log image.
+struct LogImageRows {
+    const data_t *layer;
+    float *log;
+    int width;
+
+    void operator()(int begin, int end) const {
+        for (size_t i = (size_t)begin * width; i < (size_t)end * width; ++i) {
+            data_t v = layer[i];
+            log[i] = (v < LOG_TABLE_SIZE) ? s_log_table.values[v] :
+                (float)log10((double)v);
+        }
+    }
+};
+
+/// Sums a band of columns over all rows; the rows are read in order.
+template <class T>
+struct ColumnSums {
+    const T *layer;
+    int width, height;
+    double *dest;
+
+    void operator()(int begin, int end) const {
+        std::fill(dest + begin, dest + end, 0.0);
+        for (int y = 0; y < height; ++y) {
+            const T *row = layer + (size_t)y * width;
+            for (int x = begin; x < end; ++x)
+                dest[x] += row[x];
+        }
+    }
+};
+
+/// Sums each row of a band of rows.
+template <class T>
+struct RowSums {
+    const T *layer;
+    int width;
+    double *dest;
+
+    void operator()(int begin, int end) const {
+        for (int y = begin; y < end; ++y) {
+            const T *row = layer + (size_t)y * width;
+            double sum = 0;
+            for (int x = 0; x < width; ++x)
+                sum += row[x];
+            dest[y] = sum;
+        }
+    }
+};
+
+/// Fills a band of rows of the summed-area tables with row prefix sums.
+struct SatRows {
+    const data_t *layer;
+    int width;
+    quint64 *sum;
+    double *sumsq;
+
+    void operator()(int begin, int end) const {
+        const size_t stride = width + 1;
+        for (int y = begin; y < end; ++y) {
+            const data_t *row = layer + (size_t)y * width;
+            quint64 *s = sum + (y + 1) * stride;
+            double *sq = sumsq + (y + 1) * stride;
+            s[0] = 0;
+            sq[0] = 0;
+            for (int x = 0; x < width; ++x) {
+                double v = row[x];
+                s[x+1] = s[x] + row[x];
+                sq[x+1] = sq[x] + v * v;
+            }
+        }
+    }
+};
+
+/// Accumulates a band of columns of the summed-area tables.
+struct SatColumns {
+    int width, height;
+    quint64 *sum;
+    double *sumsq;
+
+    void operator()(int begin, int end) const {
+        const size_t stride = width + 1;
+        for (int y = 2; y <= height; ++y) {
+            quint64 *s = sum + y * stride, *above = s - stride;
+            double *sq = sumsq + y * stride, *sqabove = sq - stride;
+            for (int x = begin; x < end; ++x) {
+                s[x] += above[x];
+                sq[x] += sqabove[x];
+            }
+        }
+    }
+};
+
+template <class T>
+static void projectColumns(const T *layer, int width, int height, double *dest)
+{
+    ColumnSums<T> sums;
+    sums.layer = layer;
+    sums.width = width;
+    sums.height = height;
+    sums.dest = dest;
+    // bands of at least a cache line of the output per task
+    lwParallelFor(width, sums, 64);
+}
+
+template <class T>
+static void projectRows(const T *layer, int width, int height, double *dest)
+{
+    RowSums<T> sums;
+    sums.layer = layer;
+    sums.width = width;
+    sums.dest = dest;
+    lwParallelFor(height, sums);
+}
+
 static inline uint16_t bswap_16(uint16_t x)
 {
     return (x << 8) | (x >> 8);
@@ -115,6 +257,15 @@ LWData::LWData()
     : m_data(NULL),
       m_clone(NULL),
       m_data_owned(false),
+      m_mapped_data(NULL),
+      m_mapped_clone(NULL),
+      m_mapped_size(0),
+      m_storage(NULL),
+      m_peek_z(-1),
+      m_peek_data(NULL),
+      m_generation(0),
+      m_pyramid(NULL),
+      m_sat_enabled(false),
       m_width(1),
       m_height(1),
       m_depth(1),
@@ -125,24 +276,60 @@ LWData::LWData()
 }
 
 
-#define COPY_LOOP(type, data_ptr)                       \
-    type *p = (type *)data;                                     \
-    data_t *q = data_ptr;                                       \
-    for (int i = 0; i < size(); i++){  \
-        q[i] = p[i];       \
+#define COPY_LOOP(type)                                         \
+    const type *p = (const type *)data;                         \
+    for (size_t i = 0; i < count; i++) {                        \
+        dest[i] = p[i];                                         \
+    }
+
+#define COPY_LOOP_CONVERTED(type, converter)                    \
+    const type *p = (const type *)data;                         \
+    for (size_t i = 0; i < count; i++) {                        \
+        dest[i] = converter(p[i]);                              \
     }
 
-#define COPY_LOOP_CONVERTED(type, converter, data_ptr)          \
-    type *p = (type *)data;                                     \
-    data_t *q = data_ptr;                                       \
-    for (int i = 0; i < size(); i++) {        \
-        q[i] = converter(p[i]);                                 \
+bool LWData::convertBuffer(const void *data, const std::string &format,
+                           data_t *dest, size_t count)
+{
+    // XXX currently, we interpret signed types as unsigned
+
+    // the easy case
+    if (format == "<u4" || format == "<i4" ||
+        format == "u4"  || format == "i4") {
+        memcpy(dest, data, sizeof(data_t) * count);
+    } else if (format == ">u4" || format == ">I4" || format == ">i4") {
+        COPY_LOOP_CONVERTED(uint32_t, bswap_32);
+    } else if (format == "<u2"  || format == "<i2"  ||
+               format == "u2"  || format == "i2" ) {
+        COPY_LOOP(uint16_t);
+    } else if (format == "<u1"  || format == "<i1"  ||
+               format == "u1"  || format == "i1" ) {
+        COPY_LOOP(uint8_t);
+    } else if (format == ">u2" || format == ">i2" ) {
+        COPY_LOOP_CONVERTED(uint16_t, bswap_16);
+    } else if (format == "<f8" || format == "f8" ) {
+        COPY_LOOP(double);
+    } else if (format == ">f8" ) {
+        COPY_LOOP_CONVERTED(double, bswap_64_float);
+    } else if (format == "<f4" || format == "f4" ) {
+        COPY_LOOP(float);
+    } else if (format == ">f4" ) {
+        COPY_LOOP_CONVERTED(float, bswap_32_float);
+    } else {
+        std::cerr << "Unsupported format: " << format << "!" << std::endl;
+        return false;
     }
+    return true;
+}
+
+void LWData::setStorageBudget(int megabytes)
+{
+    LWStorage::setBudget((size_t)megabytes * 1024 * 1024);
+}
 
 void LWData::initFromBuffer(const void *data, std::string format = "<u4")
 {
-    if (m_data != NULL && m_data_owned) { delete[] m_data;}
-    if (m_clone != NULL && m_data_owned) { delete[] m_clone;}
+    releaseBuffers();
     m_data = new data_t[size()]();
     m_clone = new data_t[size()]();
 
@@ -153,48 +340,39 @@ void LWData::initFromBuffer(const void *data, std::string format = "<u4")
         if (m_clone != NULL) { delete[] m_clone;m_clone=NULL;}
         return;
     }
-    if (data != NULL) {
-    // XXX currently, we interpret signed types as unsigned
-
-    // the easy case
-      if (format == "<u4" || format == "<i4" ||
-        format == "u4"  || format == "i4") {
-        memcpy(m_data, data, sizeof(data_t) * size());
-      } else if (format == ">I4" || format == ">i4") {
-        COPY_LOOP_CONVERTED(uint32_t, bswap_32, m_data);
-      } else if (format == "<u2"  || format == "<i2"  ||
-               format == "u2"  || format == "i2" ) {
-        COPY_LOOP(uint16_t, m_data);
-      } else if (format == "<u1"  || format == "<i1"  ||
-               format == "u1"  || format == "i1" ) {
-        COPY_LOOP(uint8_t, m_data);
-      } else if (format == ">u2" || format == ">i2" ) {
-        COPY_LOOP_CONVERTED(uint16_t, bswap_16, m_data);
-      } else if (format == "u1" || format == "i1" ) {
-        COPY_LOOP(uint8_t, m_data);
-      } else if (format == "<f8" || format == "f8" ) {
-        COPY_LOOP(double, m_data);
-      } else if (format == ">f8" ) {
-        COPY_LOOP_CONVERTED(double, bswap_64_float, m_data);
-      } else if (format == "<f4" || format == "f4" ) {
-        COPY_LOOP(float, m_data);
-      } else if (format == ">f4" ) {
-        COPY_LOOP_CONVERTED(float, bswap_32_float, m_data);
-      } else {
-        std::cerr << "Unsupported format: " << format << "!" << std::endl;
-      }
-    }
+    if (data != NULL)
+        convertBuffer(data, format, m_data, size());
     memcpy(m_clone, m_data, sizeof(data_t) * size());
     updateRange();
 
 
 }
 
+void LWData::initFromStorage(LWStorage *storage)
+{
+    m_width = storage->width();
+    m_height = storage->height();
+    m_depth = storage->depth();
+    m_storage = storage;
+
+    // allocate the buffers for one layer, and fill them with the first
+    initFromBuffer(m_storage->layer(0));
+}
+
 
 LWData::LWData(int width, int height, int depth, const char *data)
     : m_data(NULL),
       m_clone(NULL),
       m_data_owned(false),
+      m_mapped_data(NULL),
+      m_mapped_clone(NULL),
+      m_mapped_size(0),
+      m_storage(NULL),
+      m_peek_z(-1),
+      m_peek_data(NULL),
+      m_generation(0),
+      m_pyramid(NULL),
+      m_sat_enabled(false),
       m_width(width),
       m_height(height),
       m_depth(depth),
@@ -212,6 +390,15 @@ LWData::LWData(int width, int height, int depth,
     : m_data(NULL),
       m_clone(NULL),
       m_data_owned(false),
+      m_mapped_data(NULL),
+      m_mapped_clone(NULL),
+      m_mapped_size(0),
+      m_storage(NULL),
+      m_peek_z(-1),
+      m_peek_data(NULL),
+      m_generation(0),
+      m_pyramid(NULL),
+      m_sat_enabled(false),
       m_width(width),
       m_height(height),
       m_depth(depth),
@@ -228,6 +415,15 @@ LWData::LWData(const char* filename)
     : m_data(NULL),
       m_clone(NULL),
       m_data_owned(false),
+      m_mapped_data(NULL),
+      m_mapped_clone(NULL),
+      m_mapped_size(0),
+      m_storage(NULL),
+      m_peek_z(-1),
+      m_peek_data(NULL),
+      m_generation(0),
+      m_pyramid(NULL),
+      m_sat_enabled(false),
       m_width(0),
       m_height(0),
       m_depth(0),
@@ -243,11 +439,15 @@ LWData::LWData(const char* filename)
       m_darkfieldfile(""),
       m_normalizefile("")
 {
-    if (! _readFits(filename)) {
-        if (! _readRaw(filename)) {
-           if (! _readTiff(filename)) {
-              _dummyInit();
-           }
+    if (! _readNpy(filename)) {
+        if (! _readHdf5(filename)) {
+            if (! _readFits(filename)) {
+                if (! _readRaw(filename)) {
+                   if (! _readTiff(filename)) {
+                      _dummyInit();
+                   }
+                }
+            }
         }
     }
 }
@@ -256,12 +456,25 @@ LWData::LWData(const LWData &other)
     : m_data(NULL),
       m_clone(NULL),
       m_data_owned(false),
+      m_mapped_data(NULL),
+      m_mapped_clone(NULL),
+      m_mapped_size(0),
+      m_storage(NULL),
+      m_peek_z(-1),
+      m_peek_data(NULL),
+      m_generation(other.m_generation),
+      m_pyramid(NULL),
+      m_log_image(other.m_log_image),
+      m_sat_enabled(other.m_sat_enabled),
+      m_sat(other.m_sat),
+      m_sat_sq(other.m_sat_sq),
       m_width(other.m_width),
       m_height(other.m_height),
-      m_depth(other.m_depth),
+      // a copy of source-backed data only contains the current layer
+      m_depth(other.m_storage ? 1 : other.m_depth),
       m_min(other.m_min),
       m_max(other.m_max),
-      m_cur_z(other.m_cur_z),
+      m_cur_z(other.m_storage ? 0 : other.m_cur_z),
       m_log10(other.m_log10),
       m_custom_range(other.m_custom_range),
       m_range_min(other.m_range_min),
@@ -282,17 +495,272 @@ LWData::LWData(const LWData &other)
 
 LWData::~LWData()
 {
-    if (m_data_owned) {
-        if (m_data) {
-            delete[] m_data;
-            m_data = NULL;
+    delete m_pyramid;
+    releaseBuffers();
+    delete m_storage;
+}
+
+void LWData::releaseBuffers()
+{
+    if (m_mapped_data) {
+        munmap(m_mapped_data, m_mapped_size);
+        munmap(m_mapped_clone, m_mapped_size);
+        m_mapped_data = m_mapped_clone = NULL;
+        m_mapped_size = 0;
+    } else if (m_data_owned) {
+        delete[] m_data;
+        delete[] m_clone;
+    }
+    m_data = m_clone = NULL;
+    m_data_owned = false;
+}
+
+/* Parse the header dictionary of a .npy file, which looks like
+ *   {'descr': '<u4', 'fortran_order': False, 'shape': (16, 1024, 1024), }
+ */
+static bool parseNpyHeader(const std::string &header, std::string &descr,
+                           bool &fortran, std::vector<long> &shape)
+{
+    size_t pos, end;
+
+    pos = header.find("'descr'");
+    if (pos == std::string::npos)
+        return false;
+    pos = header.find('\'', pos + 7);
+    if (pos == std::string::npos)
+        return false;
+    end = header.find('\'', pos + 1);
+    if (end == std::string::npos)
+        return false;
+    descr = header.substr(pos + 1, end - pos - 1);
+
+    pos = header.find("'fortran_order'");
+    if (pos == std::string::npos)
+        return false;
+    pos = header.find_first_not_of(": ", pos + 15);
+    if (pos == std::string::npos)
+        return false;
+    fortran = header.compare(pos, 4, "True") == 0;
+
+    pos = header.find("'shape'");
+    if (pos == std::string::npos)
+        return false;
+    pos = header.find('(', pos);
+    end = header.find(')', pos);
+    if (pos == std::string::npos || end == std::string::npos)
+        return false;
+    shape.clear();
+    const char *p = header.c_str() + pos + 1;
+    const char *stop = header.c_str() + end;
+    while (p < stop) {
+        char *next;
+        long dim = strtol(p, &next, 10);
+        if (next == p)
+            break;
+        shape.push_back(dim);
+        p = next;
+        while (p < stop && (*p == ',' || *p == ' '))
+            p++;
+    }
+    return true;
+}
+
+bool LWData::_readNpy(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 16) {
+        close(fd);
+        return false;
+    }
+    size_t filesize = st.st_size;
+
+    // map privately and writable: filters work in place on m_data, and
+    // modified pages are copied on write instead of touching the file
+    char *map = (char *)mmap(NULL, filesize, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    if (memcmp(map, "\x93NUMPY", 6) != 0) {
+        munmap(map, filesize);
+        close(fd);
+        return false;
+    }
+
+    size_t hstart, hlen;
+    if (map[6] == 1) {
+        hstart = 10;
+        hlen = (uint8_t)map[8] | ((uint8_t)map[9] << 8);
+    } else {
+        hstart = 12;
+        hlen = (uint8_t)map[8] | ((uint8_t)map[9] << 8) |
+            ((uint8_t)map[10] << 16) | ((uint32_t)(uint8_t)map[11] << 24);
+    }
+
+    std::string descr;
+    bool fortran = false;
+    std::vector<long> shape;
+    if (hstart + hlen > filesize ||
+        !parseNpyHeader(std::string(map + hstart, hlen), descr, fortran, shape)) {
+        std::cerr << "Invalid header in NPY file " << filename << std::endl;
+        munmap(map, filesize);
+        close(fd);
+        return false;
+    }
+
+    // single-byte types have no byte order ('|u1')
+    if (descr.size() > 1 && (descr[0] == '|' || descr[0] == '=' ||
+                             descr == ">u1" || descr == ">i1"))
+        descr[0] = '<';
+    // only the types that convertBuffer() knows
+    bool supported = descr.size() == 3 && (descr[0] == '<' || descr[0] == '>') &&
+        (((descr[1] == 'u' || descr[1] == 'i') && strchr("124", descr[2])) ||
+         (descr[1] == 'f' && strchr("48", descr[2])));
+    if (!supported || shape.size() < 1 || shape.size() > 3) {
+        std::cerr << "Unsupported data type " << descr << " or shape in NPY file "
+                  << filename << std::endl;
+        munmap(map, filesize);
+        close(fd);
+        return false;
+    }
+
+    // C order: (depth, height, width); Fortran order stores the reverse
+    m_width = shape[shape.size() - 1];
+    m_height = shape.size() > 1 ? shape[shape.size() - 2] : 1;
+    m_depth = shape.size() > 2 ? shape[0] : 1;
+
+    size_t offset = hstart + hlen;
+    size_t itemsize = atoi(descr.c_str() + 2);
+    if (offset + itemsize * size() > filesize) {
+        std::cerr << "Not enough data in NPY file " << filename << std::endl;
+        munmap(map, filesize);
+        close(fd);
+        return false;
+    }
+
+    if (!fortran && m_depth > 1) {
+        // stacks can be much larger than memory: keep the file mapped and
+        // only load the layers that are looked at
+        close(fd);
+        initFromStorage(new LWMappedStorage(map, filesize, offset, descr,
+                                            m_width, m_height, m_depth));
+        return true;
+    }
+
+    if (!fortran && (descr == "<u4" || descr == "<i4") &&
+        offset % sizeof(data_t) == 0) {
+        // native layout: use the file pages directly, the second mapping
+        // keeps the original data for m_clone
+        char *clone = (char *)mmap(NULL, filesize, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE, fd, 0);
+        if (clone != MAP_FAILED) {
+            close(fd);
+            releaseBuffers();
+            m_mapped_data = map;
+            m_mapped_clone = clone;
+            m_mapped_size = filesize;
+            m_data = (data_t *)(map + offset);
+            m_clone = (data_t *)(clone + offset);
+            updateRange();
+            return true;
         }
-        if (m_clone) {
-            delete[] m_clone;
-            m_clone = NULL;
+    }
+
+    initFromBuffer(map + offset, descr);
+    munmap(map, filesize);
+    close(fd);
+
+    if (fortran && m_data) {
+        data_t *tmp = new data_t[size()];
+        for (size_t z = 0; z < (size_t)m_depth; z++)
+            for (size_t y = 0; y < (size_t)m_height; y++)
+                for (size_t x = 0; x < (size_t)m_width; x++)
+                    tmp[(z*m_height + y)*m_width + x] =
+                        m_data[z + m_depth*(y + m_height*x)];
+        memcpy(m_data, tmp, sizeof(data_t) * size());
+        memcpy(m_clone, tmp, sizeof(data_t) * size());
+        delete[] tmp;
+        updateRange();
+    }
+    return true;
+}
+
+bool LWData::saveAsNpy(const char *filename) const
+{
+    std::ostringstream dict;
+    dict << "{'descr': '<u4', 'fortran_order': False, 'shape': (";
+    if (m_depth > 1)
+        dict << m_depth << ", ";
+    dict << m_height << ", " << m_width << "), }";
+
+    // pad with spaces so that the data starts 64-byte aligned
+    std::string header = dict.str();
+    header.append((64 - (10 + header.size() + 1) % 64) % 64, ' ');
+    header += '\n';
+
+    std::ofstream fp(filename, std::ios::out | std::ios::binary);
+    if (!fp) {
+        std::cerr << "Could not open " << filename << " for writing" << std::endl;
+        return false;
+    }
+    char preamble[10] = { '\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0,
+                          (char)(header.size() & 0xFF),
+                          (char)(header.size() >> 8) };
+    fp.write(preamble, sizeof(preamble));
+    fp.write(header.data(), header.size());
+    // with storage, all layers are written raw, and read past the working
+    // set so that saving does not evict it
+    size_t layersize = (size_t)m_width * m_height;
+    std::vector<data_t> buffer;
+    for (int z = 0; z < m_depth && fp; z++) {
+        const data_t *layer = m_data + z * layersize;
+        if (m_storage)
+            layer = (z == m_cur_z) ? m_clone : m_storage->peek(z, buffer);
+        if (!layer) {
+            std::cerr << "Could not read layer " << z << " for " << filename
+                      << std::endl;
+            fp.close();
+            remove(filename);
+            return false;
         }
-        m_data_owned = false;
+        fp.write((const char *)layer, sizeof(data_t) * layersize);
+    }
+    if (!fp) {
+        std::cerr << "Could not write NPY file " << filename << std::endl;
+        fp.close();
+        remove(filename);
+        return false;
+    }
+    return true;
+}
+
+bool LWData::_readHdf5(const char *filename)
+{
+#ifdef HAVE_HDF5
+    // a dataset inside the file can be selected as "file.nxs::/entry/data/data"
+    std::string fname(filename), path;
+    std::string::size_type sep = fname.find("::");
+    if (sep != std::string::npos) {
+        path = fname.substr(sep + 2);
+        fname.erase(sep);
     }
+
+    LWHdf5Source *source = new LWHdf5Source();
+    if (!source->open(fname.c_str(), path.c_str())) {
+        delete source;
+        return false;
+    }
+    initFromStorage(new LWPagedStorage(source));
+    return true;
+#else
+    (void)filename;
+    return false;
+#endif
 }
 
 bool LWData::_readFits(const char *filename)
@@ -313,7 +781,18 @@ bool LWData::_readFits(const char *filename)
         std::cerr << "Could not open file " << filename << " as FITS" <<std::endl;
         return false;
     }
-    if (fits_get_img_param(file_pointer, max_dimensions, &bitpix,
+    // tile-compressed images (as written by saveAsFits) are stored in an
+    // extension after an empty primary HDU
+    int num_hdus = 1;
+    fits_get_img_dim(file_pointer, &num_dimensions, &status);
+    fits_get_num_hdus(file_pointer, &num_hdus, &status);
+    for (int hdu = 2; !status && num_dimensions == 0 && hdu <= num_hdus; hdu++) {
+        if (fits_movabs_hdu(file_pointer, hdu, &hdutype, &status))
+            break;
+        if (hdutype == IMAGE_HDU)
+            fits_get_img_dim(file_pointer, &num_dimensions, &status);
+    }
+    if (status || fits_get_img_param(file_pointer, max_dimensions, &bitpix,
                             &num_dimensions, dimensions, &status)) {
         std::cerr << "Could not get image params from " << filename << std::endl;
         fits_close_file(file_pointer, &status);
@@ -501,29 +980,171 @@ inline data_t LWData::data(int x, int y, int z) const
         return 0;
     if (x >= 0 && x < m_width &&
         y >= 0 && y < m_height &&
-        z >= 0 && z < m_depth)
-        return m_data[z*m_width*m_height + y*m_width + x];
+        z >= 0 && z < m_depth) {
+        if (m_storage) {
+            if (z == m_cur_z)
+                return m_data[(size_t)y*m_width + x];
+            if (z != m_peek_z) {
+                m_peek_data = m_storage->peek(z, m_peek);
+                m_peek_z = m_peek_data ? z : -1;
+            }
+            return m_peek_data ? m_peek_data[(size_t)y*m_width + x] : 0;
+        }
+        return m_data[((size_t)z*m_height + y)*m_width + x];
+    }
     return 0;
 }
 
+LWPyramid *LWData::pyramid() const
+{
+    if (!m_pyramid)
+        m_pyramid = new LWPyramid();
+    return m_pyramid;
+}
+
+void LWData::invalidate()
+{
+    m_generation = s_generation.fetchAndAddOrdered(1) + 1;
+}
+
 void LWData::updateRange()
 {
+    invalidate();
     m_min = std::numeric_limits<double>::max();
     m_max = 0;
-    for (int y = 0; y < m_height; ++y) {
-        for (int x = 0; x < m_width; ++x) {
-            double v = value((double)x, (double)y);
-            m_min = (m_min < v) ? m_min : v;
-            m_max = (m_max > v) ? m_max : v;
+
+    // with log display, compute the log image once and serve value() (and
+    // thus the plot, histogram and profiles) from it
+    m_log_image.clear();
+    if (m_log10 && m_data) {
+        m_log_image.resize(m_width * m_height);
+        LogImageRows rows;
+        rows.layer = currentLayer();
+        rows.log = m_log_image.data();
+        rows.width = m_width;
+        lwParallelFor(m_height, rows);
+
+        const float *log = m_log_image.constData();
+        for (int i = 0; i < m_log_image.size(); ++i) {
+            m_min = (m_min < log[i]) ? m_min : log[i];
+            m_max = (m_max > log[i]) ? m_max : log[i];
         }
+    } else {
+        for (int y = 0; y < m_height; ++y) {
+            for (int x = 0; x < m_width; ++x) {
+                double v = value((double)x, (double)y);
+                m_min = (m_min < v) ? m_min : v;
+                m_max = (m_max > v) ? m_max : v;
+            }
+        }
+    }
+
+    buildSummedAreaTable();
+}
+
+void LWData::buildSummedAreaTable()
+{
+    m_sat.clear();
+    m_sat_sq.clear();
+    if (!m_sat_enabled || !m_data)
+        return;
+
+    // row prefix sums first, then accumulate them down the columns
+    m_sat.resize((m_width + 1) * (m_height + 1));
+    m_sat_sq.resize(m_sat.size());
+    std::fill(m_sat.data(), m_sat.data() + m_width + 1, 0);
+    std::fill(m_sat_sq.data(), m_sat_sq.data() + m_width + 1, 0.0);
+    SatRows rows;
+    rows.layer = currentLayer();
+    rows.width = m_width;
+    rows.sum = m_sat.data();
+    rows.sumsq = m_sat_sq.data();
+    lwParallelFor(m_height, rows);
+
+    SatColumns columns;
+    columns.width = m_width;
+    columns.height = m_height;
+    columns.sum = m_sat.data();
+    columns.sumsq = m_sat_sq.data();
+    lwParallelFor(m_width + 1, columns, 64);
+}
+
+void LWData::setSummedAreaTable(bool on)
+{
+    if (m_sat_enabled == on)
+        return;
+    m_sat_enabled = on;
+    buildSummedAreaTable();
+}
+
+void LWData::clipRect(int &x, int &y, int &w, int &h) const
+{
+    int x2 = std::min(x + w, m_width), y2 = std::min(y + h, m_height);
+    x = std::max(x, 0);
+    y = std::max(y, 0);
+    w = std::max(x2 - x, 0);
+    h = std::max(y2 - y, 0);
+}
+
+double LWData::rectSum(int x, int y, int w, int h) const
+{
+    clipRect(x, y, w, h);
+    if (w == 0 || h == 0 || !m_data)
+        return 0;
+    if (!m_sat.isEmpty()) {
+        const quint64 *t = m_sat.constData();
+        const size_t stride = m_width + 1;
+        return (double)(t[(y+h)*stride + x+w] - t[y*stride + x+w] -
+                        t[(y+h)*stride + x] + t[y*stride + x]);
+    }
+    const data_t *layer = currentLayer();
+    quint64 sum = 0;
+    for (int j = y; j < y + h; ++j)
+        for (int i = x; i < x + w; ++i)
+            sum += layer[(size_t)j*m_width + i];
+    return (double)sum;
+}
+
+LWRoiStats LWData::rectStats(int x, int y, int w, int h) const
+{
+    LWRoiStats stats;
+    clipRect(x, y, w, h);
+    stats.pixels = w * h;
+    stats.sum = stats.mean = stats.variance = 0;
+    if (stats.pixels == 0 || !m_data)
+        return stats;
+
+    double sumsq = 0;
+    if (!m_sat_sq.isEmpty()) {
+        const double *t = m_sat_sq.constData();
+        const size_t stride = m_width + 1;
+        sumsq = t[(y+h)*stride + x+w] - t[y*stride + x+w] -
+            t[(y+h)*stride + x] + t[y*stride + x];
+    } else {
+        const data_t *layer = currentLayer();
+        for (int j = y; j < y + h; ++j)
+            for (int i = x; i < x + w; ++i) {
+                double v = layer[(size_t)j*m_width + i];
+                sumsq += v * v;
+            }
     }
+    stats.sum = rectSum(x, y, w, h);
+    stats.mean = stats.sum / stats.pixels;
+    // rounding in the table can make it slightly negative
+    stats.variance = std::max(sumsq / stats.pixels - stats.mean * stats.mean, 0.);
+    return stats;
 }
 
 double LWData::value(double x, double y) const
 {
+    if (m_log10) {
+        int ix = (int)x, iy = (int)y;
+        if (!m_log_image.isEmpty() && ix >= 0 && ix < m_width &&
+            iy >= 0 && iy < m_height)
+            return m_log_image[(size_t)iy*m_width + ix];
+        return safe_log10((double)data(ix, iy, m_cur_z));
+    }
     double v = (double)data((int)x, (int)y, m_cur_z);
-    if (m_log10)
-        v = safe_log10(v);
     /*
     if (m_custom_range) {
         v = (v > m_range_max) ? m_range_max : v;
@@ -543,6 +1164,26 @@ double LWData::valueRaw(int x, int y, int z) const
     return (double)data(x, y, z);
 }
 
+void LWData::projectColumns(double *dest, bool raw) const
+{
+    if (!m_data)
+        std::fill(dest, dest + m_width, 0.0);
+    else if (!raw && !m_log_image.isEmpty())
+        ::projectColumns(m_log_image.constData(), m_width, m_height, dest);
+    else
+        ::projectColumns(currentLayer(), m_width, m_height, dest);
+}
+
+void LWData::projectRows(double *dest, bool raw) const
+{
+    if (!m_data)
+        std::fill(dest, dest + m_height, 0.0);
+    else if (!raw && !m_log_image.isEmpty())
+        ::projectRows(m_log_image.constData(), m_width, m_height, dest);
+    else
+        ::projectRows(currentLayer(), m_width, m_height, dest);
+}
+
 void LWData::histogram(int bins, double *xs, double *ys) const
 {
     double step = (m_max - m_min) / (double)bins;
@@ -584,6 +1225,17 @@ void LWData::setCurrentZ(int val)
         std::cerr << "invalid current Z selected" << std::endl;
         return;
     }
+    if (m_storage && val != m_cur_z) {
+        // may evict the layer that data() peeked at
+        m_peek_z = -1;
+        const data_t *layer = m_storage->layer(val);
+        if (!layer) {
+            std::cerr << "could not read layer " << val << std::endl;
+            return;
+        }
+        memcpy(m_clone, layer, sizeof(data_t) * size());
+        reprocess();
+    }
     m_cur_z = val;
     updateRange();
 }
@@ -605,32 +1257,36 @@ void LWData::setLog10(bool val)
     }
 }
 
+void LWData::applyDespeckle()
+{
+    CLOCK_START();
+    float *pdata = (float *)malloc(size() * sizeof(float));
+    for (size_t i = 0; i < size(); ++i)
+        pdata[i] = (float)m_data[i];
+    CLOCK_STOP("malloc and copy");
+
+    CLOCK_START();
+    LWImageProc::despeckleFilter(pdata, m_despecklevalue, m_width, m_height);
+    CLOCK_STOP("despeckle filter");
+
+    CLOCK_START();
+    for (size_t i = 0; i < size(); ++i)
+        m_data[i] = (data_t)pdata[i];
+    CLOCK_STOP("copy back to data");
+
+    free(pdata);
+}
+
 void LWData::setDespeckled(bool val)
 {
     if (m_despeckled == val)
         return;
     m_despeckled = val;
 
-    if (m_despeckled) {
-        CLOCK_START();
-        float *pdata = (float *)malloc(size() * sizeof(float));
-        for (int i = 0; i < size(); ++i)
-            pdata[i] = (float)m_data[i];
-        CLOCK_STOP("malloc and copy");
-
-        CLOCK_START();
-        LWImageProc::despeckleFilter(pdata, m_despecklevalue, m_width, m_height);
-        CLOCK_STOP("despeckle filter");
-
-        CLOCK_START();
-        for (int i = 0; i < size(); ++i)
-            m_data[i] = (data_t)pdata[i];
-        CLOCK_STOP("copy back to data");
-
-        free(pdata);
-    } else {
+    if (m_despeckled)
+        applyDespeckle();
+    else
         memcpy(m_data, m_clone, sizeof(data_t) * size());
-    }
     updateRange();
 }
 
@@ -641,19 +1297,55 @@ void LWData::setDespeckleValue(float value)
     m_despecklevalue = value;
 
     memcpy(m_data, m_clone, sizeof(data_t) * size());
+    applyDespeckle();
+    updateRange();
+}
 
-    float *pdata = (float *)malloc(size() * sizeof(float));
-    for (int i = 0; i < size(); ++i)
-        pdata[i] = (float)m_data[i];
+void LWData::applyNormalization()
+{
+    float *data = (float *)malloc(size() * sizeof(float));
+    for (size_t i = 0; i < size(); ++i)
+        data[i] = (float)m_data[i];
+
+    CLOCK_START();
+    LWData openbeam(m_normalizefile.toStdString().c_str());
+    float *ob_data = (float *)malloc(size() * sizeof(float));
+    for (size_t i = 0; i < size(); ++i)
+        ob_data[i] = openbeam.buffer()[i];
+    CLOCK_STOP("loaded openbeam image");
+
+    CLOCK_START();
+    LWData darkfield(m_darkfieldfile.toStdString().c_str());
+    float *di_data = (float *)malloc(size() * sizeof(float));
+    for (size_t i = 0; i < size(); ++i)
+        di_data[i] = darkfield.buffer()[i];
+    CLOCK_STOP("loaded dark image");
 
-    LWImageProc::despeckleFilter(pdata, m_despecklevalue, m_width, m_height);
+    if (m_despeckled) {
+        CLOCK_START();
+        LWImageProc::despeckleFilter(di_data, m_despecklevalue, m_width, m_height);
+        LWImageProc::despeckleFilter(ob_data, m_despecklevalue, m_width, m_height);
+        LWImageProc::despeckleFilter(data, m_despecklevalue, m_width, m_height);
+        CLOCK_STOP("removed gamma spots");
+    }
 
-    for (int i = 0; i < size(); ++i)
-        m_data[i] = (data_t)pdata[i];
+    CLOCK_START();
+    LWImageProc::pixelwiseSubtractImages(ob_data, di_data, m_width, m_height);
+    CLOCK_STOP("pixelwise subtract dark image from openbeam image");
 
-    free(pdata);
+    CLOCK_START();
+    LWImageProc::pixelwiseSubtractImages(data, di_data, m_width, m_height);
+    CLOCK_STOP("pixelwise subtract dark image from data");
 
-    updateRange();
+    CLOCK_START();
+    LWImageProc::pixelwiseDivideImages(data, ob_data, m_width, m_height);
+    CLOCK_STOP("pixelwise divide images");
+
+    clampedCopyFloatVals(data);
+
+    free(data);
+    free(ob_data);
+    free(di_data);
 }
 
 void LWData::setNormalized(bool val)
@@ -663,50 +1355,7 @@ void LWData::setNormalized(bool val)
     m_normalized = val;
 
     if (m_normalized) {
-        float *data = (float *)malloc(size() * sizeof(float));
-        for (int i = 0; i < size(); ++i)
-            data[i] = (float)m_data[i];
-
-        CLOCK_START();
-        LWData openbeam(m_normalizefile.toStdString().c_str());
-        float *ob_data = (float *)malloc(size() * sizeof(float));
-        for (int i = 0; i < size(); ++i)
-            ob_data[i] = openbeam.buffer()[i];
-        CLOCK_STOP("loaded openbeam image");
-
-        CLOCK_START();
-        LWData darkfield(m_darkfieldfile.toStdString().c_str());
-        float *di_data = (float *)malloc(size() * sizeof(float));
-        for (int i = 0; i < size(); ++i)
-            di_data[i] = darkfield.buffer()[i];
-        CLOCK_STOP("loaded dark image");
-
-        if (m_despeckled) {
-            CLOCK_START();
-            LWImageProc::despeckleFilter(di_data, m_despecklevalue, m_width, m_height);
-            LWImageProc::despeckleFilter(ob_data, m_despecklevalue, m_width, m_height);
-            LWImageProc::despeckleFilter(data, m_despecklevalue, m_width, m_height);
-            CLOCK_STOP("removed gamma spots");
-        }
-
-        CLOCK_START();
-        LWImageProc::pixelwiseSubtractImages(ob_data, di_data, m_width, m_height);
-        CLOCK_STOP("pixelwise subtract dark image from openbeam image");
-
-        CLOCK_START();
-        LWImageProc::pixelwiseSubtractImages(data, di_data, m_width, m_height);
-        CLOCK_STOP("pixelwise subtract dark image from data");
-
-        CLOCK_START();
-        LWImageProc::pixelwiseDivideImages(data, ob_data, m_width, m_height);
-        CLOCK_STOP("pixelwise divide images");
-
-        clampedCopyFloatVals(data);
-
-        free(data);
-        free(ob_data);
-        free(di_data);
-
+        applyNormalization();
         updateRange();
     } else {
         CLOCK_START();
@@ -729,7 +1378,7 @@ void LWData::setNormalizeFile(QString val)
 
 
 void LWData::clampedCopyFloatVals(float* pdata){
-        for (int i = 0; i < size(); ++i){
+        for (size_t i = 0; i < size(); ++i){
             if ( pdata[i] >  std::numeric_limits<data_t>::min()) {
 		if ( pdata[i] < std::numeric_limits<data_t>::max() ) {
 	            m_data[i] = (data_t)pdata[i];
@@ -742,6 +1391,28 @@ void LWData::clampedCopyFloatVals(float* pdata){
         }
 }
 
+void LWData::applyDarkfield()
+{
+    float *pdata = (float *)malloc(size() * sizeof(float));
+    for (size_t i = 0; i < size(); ++i)
+        pdata[i] = (float)m_data[i];
+
+    CLOCK_START();
+    LWData darkfield(m_darkfieldfile.toStdString().c_str());
+    float *sdata = (float *)malloc(size() * sizeof(float));
+    for (size_t i = 0; i < size(); ++i)
+        sdata[i] = darkfield.buffer()[i];
+    CLOCK_STOP("load darkfield image");
+
+    CLOCK_START();
+    LWImageProc::pixelwiseSubtractImages(pdata, sdata, m_width, m_height);
+    CLOCK_STOP("pixelwise subtract images");
+
+    clampedCopyFloatVals(pdata);
+    free(pdata);
+    free(sdata);
+}
+
 void LWData::setDarkfieldSubtracted(bool val)
 {
     if (m_darkfieldsubtracted == val)
@@ -749,24 +1420,7 @@ void LWData::setDarkfieldSubtracted(bool val)
     m_darkfieldsubtracted = val;
 
     if (m_darkfieldsubtracted) {
-        float *pdata = (float *)malloc(size() * sizeof(float));
-        for (int i = 0; i < size(); ++i)
-            pdata[i] = (float)m_data[i];
-
-        CLOCK_START();
-        LWData darkfield(m_darkfieldfile.toStdString().c_str());
-        float *sdata = (float *)malloc(size() * sizeof(float));
-        for (int i = 0; i < size(); ++i)
-            sdata[i] = darkfield.buffer()[i];
-        CLOCK_STOP("load darkfield image");
-
-        CLOCK_START();
-        LWImageProc::pixelwiseSubtractImages(pdata, sdata, m_width, m_height);
-        CLOCK_STOP("pixelwise subtract images");
-
-        clampedCopyFloatVals(pdata);
-        free(pdata);
-        free(sdata);
+        applyDarkfield();
         updateRange();
     } else {
         CLOCK_START();
@@ -786,34 +1440,57 @@ void LWData::setDarkfieldFile(QString val)
     m_darkfieldfile = val;
 }
 
+void LWData::applyImageFilter()
+{
+    float *pdata = (float *)malloc(size() * sizeof(float));
+
+    for (size_t i = 0; i < size(); ++i)
+        pdata[i] = (float)m_data[i];
+
+    if (m_filter == MedianFilter) {
+        LWImageProc::medianFilter(pdata, m_width, m_height);
+    } else if (m_filter == HybridMedianFilter) {
+        LWImageProc::hybridmedianFilter(pdata, m_width, m_height);
+    } else if (m_filter == DespeckleFilter) {
+        LWImageProc::despeckleFilter(pdata, m_despecklevalue, m_width, m_height);
+    }
+
+    for (size_t i = 0; i < size(); ++i)
+        m_data[i] = (data_t)pdata[i];
+
+    free(pdata);
+}
+
 void LWData::setImageFilter(LWImageFilters which)
 {
     if (m_filter == which)
         return;
 
     m_filter = which;
-    if (m_filter == NoImageFilter) {
+    if (m_filter == NoImageFilter)
         memcpy(m_data, m_clone, sizeof(data_t) * size());
-    } else {
-        float *pdata = (float *)malloc(size() * sizeof(float));
+    else
+        applyImageFilter();
+    updateRange();
+}
 
-        for (int i=0; i<size(); ++i)
-            pdata[i] = (float)m_data[i];
+void LWData::applyImageOperation()
+{
+    float *pdata = (float *)malloc(size() * sizeof(float));
 
-        if (m_filter == MedianFilter) {
-            LWImageProc::medianFilter(pdata, m_width, m_height);
-        } else if (m_filter == HybridMedianFilter) {
-            LWImageProc::hybridmedianFilter(pdata, m_width, m_height);
-        } else if (m_filter == DespeckleFilter) {
-            LWImageProc::despeckleFilter(pdata, m_despecklevalue, m_width, m_height);
-        }
+    for (size_t i = 0; i < size(); ++i)
+        pdata[i] = (float)m_data[i];
 
-        for (int i = 0; i < size(); ++i)
-            m_data[i] = (data_t)pdata[i];
+    if (m_operation == StackAverage) {
+        str_vec myList;
 
-        free(pdata);
+        LWImageProc::pixelwiseAverage(pdata, myList, m_width, m_height);
     }
-    updateRange();
+
+    for (size_t i = 0; i < size(); ++i)
+        m_data[i] = (data_t)pdata[i];
+
+    free(pdata);
 }
 
 void LWData::setImageOperation(LWImageOperations which)
@@ -822,28 +1499,29 @@ void LWData::setImageOperation(LWImageOperations which)
         return;
 
     m_operation = which;
-    if (m_operation == NoImageOperation) {
+    if (m_operation == NoImageOperation)
         memcpy(m_data, m_clone, sizeof(data_t) * size());
-    } else {
-        float *pdata = (float *)malloc(size() * sizeof(float));
-
-        for (int i = 0; i < size(); ++i)
-            pdata[i] = (float)m_data[i];
-
-        if (m_operation == StackAverage) {
-            str_vec myList;
-
-            LWImageProc::pixelwiseAverage(pdata, myList, m_width, m_height);
-        }
-
-        for (int i = 0; i < size(); ++i)
-            m_data[i] = (data_t)pdata[i];
-
-        free(pdata);
-    }
+    else
+        applyImageOperation();
     updateRange();
 }
 
+void LWData::reprocess()
+{
+    memcpy(m_data, m_clone, sizeof(data_t) * size());
+    // the normalization despeckles and subtracts the darkfield itself
+    if (m_despeckled && !m_normalized)
+        applyDespeckle();
+    if (m_darkfieldsubtracted && !m_normalized)
+        applyDarkfield();
+    if (m_normalized)
+        applyNormalization();
+    if (m_filter != NoImageFilter)
+        applyImageFilter();
+    if (m_operation != NoImageOperation)
+        applyImageOperation();
+}
+
 
 double LWData::customRangeMin() const
 {
@@ -868,148 +1546,51 @@ void LWData::setCustomRange(double lower, double upper)
         m_range_min = (lower < upper) ? lower : upper;
         m_range_max = (lower < upper) ? upper : lower;
     }
-    updateRange();
+    // the data itself is unchanged, no need for updateRange()
 }
 
 
 
-void LWData::saveAsFitsImage(float *data, char *fits_filename)
+bool LWData::saveAsFits(const char *filename,
+                        LWFitsCompression compression) const
 {
-    long 		 dimensions[2] = {m_width, m_height};
-    fitsfile    *ffptr;
-    int 		 status = 0;
-    int          exists = 0;
-
-    if (fits_file_exists(fits_filename, &exists, &status)) {
-        if (fits_create_file(&ffptr, fits_filename, &status))
-            std::cerr << "doesn't exist but still couldn't create file" << std::endl;
-    } else {
-        // XXX doesn't belong here, LWData is not supposed to use GUI
-/*        switch (QMessageBox::warning(NULL, "Replace file?",
-                                     "Do you want to replace \n" + (QString)fits_filename, "&Yes", "&No") )
-        {
-            case 0:
-                if (fits_open_file(&ffptr, fits_filename, READWRITE, &status))
-                    std::cerr << "couldn't open file" << std::endl;
-                if (fits_delete_file(ffptr, &status))
-                    std::cerr << "couldn't delete existing file" << std::endl;
-                if (fits_create_file(&ffptr, fits_filename, &status))
-                    std::cerr << "couldn't create file" << std::endl;
-                break;
-
-            default:
-                break;
-        }
-*/
+    QString error;
+    if (!LWFitsWriter::write(filename, m_width, m_height, currentLayer(),
+                             compression, &error)) {
+        std::cerr << "could not write " << filename << ": "
+                  << error.toStdString() << std::endl;
+        return false;
     }
+    return true;
+}
 
-    if (fits_create_img(ffptr, 32, 2, dimensions, &status))
-        std::cerr << "couldn't add image table" << std::endl;
-
-    if (fits_write_img(ffptr, TFLOAT, 1, 2048*2048, data, &status))
-        std::cerr << "couldn't write data" << std::endl;
-
-    fits_close_file(ffptr, &status);
-
-    if (status)
-        fits_report_error(stderr, status);   // print any cfitsio error message
+void LWData::saveAsFitsImage(float *data, char *fits_filename)
+{
+    QString error;
+    if (!LWFitsWriter::write(fits_filename, m_width, m_height, data,
+                             FitsUncompressed, &error))
+        std::cerr << "could not write " << fits_filename << ": "
+                  << error.toStdString() << std::endl;
 }
 
 
 
 float LWData::getFloatFromFitsHeader(const char *filename, const char *headerEntry)
 {
-    fitsfile *file_pointer;    // CFITSIO file pointer, defined in fitsio.h
-    int status = 0;            // CFITSIO status, must be initialized to zero
-
-    char value[FLEN_CARD];
-
-    if (!fits_open_file(&file_pointer, filename, READONLY, &status))
-    {
-        if (!fits_read_card(file_pointer, headerEntry, value, &status))
-        {
-            fits_close_file(file_pointer, &status);
-
-            if (status)
-                fits_report_error(stderr, status);   // print any cfitsio error message
-
-            std::cout << value << std::endl;
-            QString val = value;
-            QStringList line = val.split(" ");
-            float v;
-
-            if (line.at(0).toStdString() != "HIERARCH")
-            {
-                line = val.split("=");
-                v = line.at(1).toFloat();
-                std::cout << line.at(1).toFloat() << std::endl;
-            }
-            else
-            {
-                line = val.split("'");
-                v = line.at(1).split(" ")[0].toFloat();
-                std::cout << line.at(1).split(" ")[0].toFloat() << std::endl;
-            }
-
-            return v;
-        }
-        else
-        {
-            std::cout << "Could not find header keyword: " << headerEntry << std::endl;
-            return 0.0;
-        }
-    }
-    else
-    {
-        std::cerr << "Could not open file " << filename << std::endl;
-        return 0.0;
-    }
+    QVariant value = LWFitsHeader::value(filename, headerEntry);
+    // HIERARCH values carry their unit, like '12.5 mm'
+    if (value.type() == QVariant::String)
+        return value.toString().split(" ").at(0).toFloat();
+    return (float)value.toDouble();
 }
 
 std::string LWData::getStringFromFitsHeader(const char *filename, const char *headerEntry)
 {
-    fitsfile *file_pointer;    // CFITSIO file pointer, defined in fitsio.h
-    int status = 0;            // CFITSIO status, must be initialized to zero
-
-    char value[FLEN_CARD];
-
-    if (!fits_open_file(&file_pointer, filename, READONLY, &status))
-    {
-        if (!fits_read_card(file_pointer, headerEntry, value, &status))
-        {
-            fits_close_file(file_pointer, &status);
-
-            if (status)
-                fits_report_error(stderr, status);   // print any cfitsio error message
-
-            std::cout << value << std::endl;
-            QString val = value;
-            QStringList line = val.split(" ");
-            std::string v;
-
-            if (line.at(0).toStdString() == "HIERARCH")
-            {
-                line = val.split("'");
-                v = line.at(1).split(" ")[0].toStdString();
-                std::cout << v << std::endl;
-            }
-            else
-            {
-                v = "+";
-                std::cout << "default polarity is positive" << std::endl;
-            }
-
-            return v;
-        }
-        else
-        {
-            std::cout << "Could not find header keyword: " << headerEntry << std::endl;
-            return " ";
-        }
-    }
-    else
-    {
-        std::cerr << "Could not open file " << filename << std::endl;
+    QVariant value = LWFitsHeader::value(filename, headerEntry);
+    if (!value.isValid())
         return " ";
-    }
+    if (LWFitsHeader::isHierarch(filename, headerEntry))
+        return value.toString().split(" ").at(0).toStdString();
+    // default polarity is positive
+    return "+";
 }
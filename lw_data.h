@@ -26,6 +26,10 @@
 #define LW_DATA_H
 
 #include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <QVector>
 
 #include <qwt_plot_spectrogram.h>
 
@@ -38,12 +42,33 @@
 // data type used for single pixel count values
 typedef uint32_t data_t;
 
+
+class LWPyramid;
+class LWStorage;
+
+
+/// Statistics of the raw counts in a rectangle of the current layer.
+struct LWRoiStats {
+    int pixels;
+    double sum;
+    double mean;
+    double variance;
+};
+
+
 class LWData
 {
   private:
     virtual void updateRange();
+    void invalidate();
+    void buildSummedAreaTable();
+    void clipRect(int &x, int &y, int &w, int &h) const;
     virtual void initFromBuffer(const void *data, std::string format);
     void _dummyInit();
+    void releaseBuffers();
+    bool _readNpy(const char *filename);
+    bool _readHdf5(const char *filename);
+    void initFromStorage(LWStorage *storage);
     bool _readFits(const char *filename);
     bool _readRaw(const char *filename);
     bool _readTiff(const char *filename);
@@ -53,6 +78,25 @@ class LWData
     data_t *m_data;   // processed data
     data_t *m_clone;  // original data without filters/processing applied
     bool m_data_owned;
+    char *m_mapped_data;   // private file mappings backing m_data/m_clone
+    char *m_mapped_clone;  // (NULL if the buffers are heap allocated)
+    size_t m_mapped_size;
+    // if set, m_data and m_clone hold only the current layer, the others
+    // are taken from the storage on demand
+    LWStorage *m_storage;
+    // the last layer other than the current one read by data(), without
+    // disturbing the storage's working set
+    mutable int m_peek_z;
+    mutable const data_t *m_peek_data;
+    mutable std::vector<data_t> m_peek;
+    int m_generation;
+    mutable LWPyramid *m_pyramid;  // created on first use
+    QVector<float> m_log_image;    // log10 of the current layer, if m_log10
+    // summed-area tables of the raw counts and their squares, with a zero
+    // row and column in front: (width+1)*(height+1) entries, if enabled
+    bool m_sat_enabled;
+    QVector<quint64> m_sat;
+    QVector<double> m_sat_sq;
     int m_width, m_height, m_depth;
     double m_min, m_max;
 
@@ -72,9 +116,21 @@ class LWData
     QString m_darkfieldfile;
     QString m_normalizefile;
     void clampedCopyFloatVals(float* pdata);
+    // apply one processing step to m_data in place
+    void applyDespeckle();
+    void applyNormalization();
+    void applyDarkfield();
+    void applyImageFilter();
+    void applyImageOperation();
+    /// Rebuild m_data from m_clone with all active processing, e.g. for
+    /// a new layer from the storage.
+    void reprocess();
 
     data_t data(int x, int y, int z) const;
-    int size() const { return m_width * m_height * m_depth; }
+    /// Number of values held in m_data.
+    size_t size() const {
+        return (size_t)m_width * m_height * (m_storage ? 1 : m_depth);
+    }
 
   public:
     LWData();
@@ -85,8 +141,17 @@ class LWData
 
     virtual ~LWData();
 
+    /// Convert "count" values in a numpy style format like "<u2" to data_t.
+    static bool convertBuffer(const void *data, const std::string &format,
+                              data_t *dest, size_t count);
+    /// Memory that out-of-core stacks (3D NPY, HDF5) may keep resident.
+    static void setStorageBudget(int megabytes);
+
     const data_t *buffer() const { return m_data; }
     const data_t *buffer_clone() const { return m_clone; }
+    /// Processed values of the current layer (width*height values).
+    const data_t *currentLayer() const {
+        return m_storage ? m_data : m_data + (size_t)m_cur_z * m_width * m_height; }
 
     int width() const { return m_width; }
     int height() const { return m_height; }
@@ -94,11 +159,20 @@ class LWData
     double min() const { return m_min; }
     double max() const { return m_max; }
 
+    /// Changes whenever the presented values of the current layer change
+    /// (but not for a new custom range); unique across all LWData objects.
+    int generation() const { return m_generation; }
+    /// Reduced versions of the current layer for zoomed-out display.
+    LWPyramid *pyramid() const;
+
     int currentZ() const { return m_cur_z; }
     virtual void setCurrentZ(int val);
 
     bool isLog10() const { return m_log10; }
     virtual void setLog10(bool val);
+    /// With log display on, the log10 of the current layer (width*height
+    /// values), computed once per generation; else empty.
+    const QVector<float> &logImage() const { return m_log_image; }
 
     bool isNormalized() const { return m_normalized; }
     QString getNormalizeFile() const { return m_normalizefile; }
@@ -121,6 +195,13 @@ class LWData
     LWImageOperations isImageOperation() const { return m_operation; }
     virtual void setImageOperation(LWImageOperations which);
 
+    /// Write all layers of the processed data as a NumPy .npy file.
+    bool saveAsNpy(const char *filename) const;
+
+    /// Write the current layer as a FITS image, see LWFitsWriter for
+    /// writing in the background.
+    bool saveAsFits(const char *filename,
+                    LWFitsCompression compression = FitsUncompressed) const;
     void saveAsFitsImage(float *data, char *fits_filename);
     std::string getStringFromFitsHeader(const char *filename, const char *headerEntry);
     float getFloatFromFitsHeader(const char *filename, const char *headerEntry) ;
@@ -144,6 +225,21 @@ class LWData
     virtual void histogram(int bins, QVector<double> **xs,
                            QVector<double> **ys) const;
 
+    /// Sum the presentation values of the current layer over each column
+    /// into dest[x] (width values), or over each row into dest[y] (height
+    /// values), directly from the pixel buffer.  With "raw", the counts
+    /// are summed even if the log10 image is shown.
+    void projectColumns(double *dest, bool raw = false) const;
+    void projectRows(double *dest, bool raw = false) const;
+
+    /// Keep summed-area tables of the current layer (16 bytes per pixel),
+    /// rebuilt with every new generation, so that rectangle sums and
+    /// statistics take constant time.  Off by default.
+    bool hasSummedAreaTable() const { return m_sat_enabled; }
+    void setSummedAreaTable(bool on);
+    /// Sum of the raw counts in the rectangle (clipped to the data).
+    double rectSum(int x, int y, int w, int h) const;
+    LWRoiStats rectStats(int x, int y, int w, int h) const;
 };
 
 
@@ -184,6 +280,10 @@ class LWRasterData : public QwtRasterData
         return m_data->valueRaw(x, y);
     }
 
+    const LWData *lwData() const {
+        return m_data;
+    }
+
     int width() {
         return m_data->width();
     }
@@ -0,0 +1,401 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#include <iostream>
+#include <math.h>
+
+#include <QAtomicInt>
+#include <QDir>
+#include <QFileInfo>
+#include <QMap>
+#include <QPainter>
+#include <QPalette>
+#include <QSet>
+
+#include <qwt_scale_draw.h>
+#include <qwt_scale_engine.h>
+
+#include "lw_export.h"
+#include "lw_parallel.h"
+#include "lw_spectrogram.h"
+
+
+// room around the image for the axes and the color bar
+#define MARGIN       10
+#define AXIS_LEFT    60
+#define AXIS_BOTTOM  30
+#define BAR_GAP      10
+#define BAR_WIDTH    20
+#define BAR_LABELS   60
+
+
+namespace {
+
+/// Colors a band of image rows straight from the pixel buffer through the
+/// table of an LWColorLut; rows and columns are sampled from the data with
+/// nearest neighbors, row 0 is the top of the data.
+template <class T>
+struct PixelRows {
+    const T *source;
+    int width, height;
+    bool log10;
+    const int *columns;  // source column of each image column
+    const QRgb *table;
+    int tableSize;
+    double lower, scale;  // value -> table index
+    uchar *bits;
+    int bytesPerLine;
+    QRect area;
+
+    void operator()(int begin, int end) const {
+        for (int j = begin; j < end; ++j) {
+            int y = (int)((qint64)(area.height() - 1 - j) * height / area.height());
+            const T *row = source + (size_t)y * width;
+            QRgb *line = (QRgb *)(bits + (size_t)(area.top() + j) * bytesPerLine)
+                + area.left();
+            for (int i = 0; i < area.width(); ++i) {
+                double v = (double)row[columns[i]];
+                if (log10)
+                    v = (v > 0) ? ::log10(v) : -1.;
+                // the same as LWColorLut::rgb()
+                v = (v - lower) * scale;
+                if (!(v > 0))
+                    line[i] = table[0];
+                else if (v >= tableSize - 1)
+                    line[i] = table[tableSize - 1];
+                else
+                    line[i] = table[(int)v];
+            }
+        }
+    }
+};
+
+template <class T>
+void colorPixels(const T *source, bool log10, const LWData *data,
+                 const LWColorLut &lut, const QwtDoubleInterval &range,
+                 QImage &image, const QRect &area)
+{
+    QVector<int> columns(area.width());
+    for (int i = 0; i < columns.size(); ++i)
+        columns[i] = (int)((qint64)i * data->width() / area.width());
+
+    PixelRows<T> rows;
+    rows.source = source;
+    rows.width = data->width();
+    rows.height = data->height();
+    rows.log10 = log10;
+    rows.columns = columns.constData();
+    rows.table = lut.table();
+    rows.tableSize = lut.size();
+    rows.lower = range.minValue();
+    rows.scale = lut.size() / range.width();
+    // QImage::scanLine() may detach, only touch the bits in the threads
+    rows.bits = image.bits();
+    rows.bytesPerLine = image.bytesPerLine();
+    rows.area = area;
+    lwParallelFor(area.height(), rows);
+}
+
+/// Exports one file of a saveFiles() call per index.
+struct FileExport {
+    const LWExporter *exporter;
+    const QStringList *filenames;
+    const QStringList *targets;  // unique, per file
+    QString format;
+    bool log10;
+    QAtomicInt *written;
+
+    void operator()(int begin, int end) const {
+        for (int k = begin; k < end; ++k) {
+            const QString &filename = filenames->at(k);
+            LWData data(filename.toLocal8Bit().constData());
+            // unreadable files give a single dummy pixel
+            if (data.width() * data.height() <= 1) {
+                std::cerr << "could not read " << filename.toLocal8Bit().constData()
+                          << std::endl;
+                continue;
+            }
+            data.setLog10(log10);
+            if (exporter->save(&data, targets->at(k),
+                               format.toLatin1().constData()))
+                written->fetchAndAddOrdered(1);
+        }
+    }
+};
+
+}
+
+
+LWExporter::LWExporter()
+    : m_colormap(NULL),
+      m_custom_range(false),
+      m_range_min(0),
+      m_range_max(0),
+      m_axes(false),
+      m_colorbar(false)
+{
+    setStandardColorMap(false, false);
+}
+
+LWExporter::LWExporter(const LWExporter &other)
+    : m_colormap(other.m_colormap->copy()),
+      m_size(other.m_size),
+      m_custom_range(other.m_custom_range),
+      m_range_min(other.m_range_min),
+      m_range_max(other.m_range_max),
+      m_axes(other.m_axes),
+      m_colorbar(other.m_colorbar)
+{
+}
+
+LWExporter &LWExporter::operator=(const LWExporter &other)
+{
+    if (this != &other) {
+        setColorMap(*other.m_colormap);
+        m_size = other.m_size;
+        m_custom_range = other.m_custom_range;
+        m_range_min = other.m_range_min;
+        m_range_max = other.m_range_max;
+        m_axes = other.m_axes;
+        m_colorbar = other.m_colorbar;
+    }
+    return *this;
+}
+
+LWExporter::~LWExporter()
+{
+    delete m_colormap;
+}
+
+QwtLinearColorMap LWExporter::standardColorMap(bool grayscale, bool cyclic)
+{
+    if (grayscale)
+        return QwtLinearColorMap(Qt::black, Qt::white);
+    if (cyclic) {
+        // e.g. for phase (0..2pi) display
+        QwtLinearColorMap colorMap(Qt::blue, Qt::blue);
+        colorMap.addColorStop(0.0, Qt::blue);
+        colorMap.addColorStop(0.75, Qt::red);
+        colorMap.addColorStop(0.5, Qt::yellow);
+        colorMap.addColorStop(0.25, Qt::cyan);
+        colorMap.addColorStop(1.0, Qt::blue);
+        return colorMap;
+    }
+    QwtLinearColorMap colorMap(Qt::blue, Qt::red);
+    colorMap.addColorStop(0.0, Qt::blue);
+    colorMap.addColorStop(0.33, Qt::cyan);
+    colorMap.addColorStop(0.66, Qt::yellow);
+    colorMap.addColorStop(1.0, Qt::red);
+    return colorMap;
+}
+
+void LWExporter::setColorMap(const QwtColorMap &map)
+{
+    QwtColorMap *copy = map.copy();
+    delete m_colormap;
+    m_colormap = copy;
+}
+
+void LWExporter::setStandardColorMap(bool grayscale, bool cyclic)
+{
+    setColorMap(standardColorMap(grayscale, cyclic));
+}
+
+void LWExporter::setSize(int width, int height)
+{
+    m_size = QSize(width, height);
+}
+
+void LWExporter::setCustomRange(double lower, double upper)
+{
+    m_custom_range = true;
+    m_range_min = lower;
+    m_range_max = upper;
+}
+
+void LWExporter::clearCustomRange()
+{
+    m_custom_range = false;
+}
+
+void LWExporter::setAxes(bool on)
+{
+    m_axes = on;
+}
+
+void LWExporter::setColorBar(bool on)
+{
+    m_colorbar = on;
+}
+
+QwtDoubleInterval LWExporter::rangeFor(const LWData *data) const
+{
+    // the same as LWRasterData::range()
+    if (m_custom_range)
+        return QwtDoubleInterval(m_range_min, m_range_max);
+    if (data->hasCustomRange())
+        return QwtDoubleInterval(data->customRangeMin(), data->customRangeMax());
+    return QwtDoubleInterval(data->min(), data->max());
+}
+
+QImage LWExporter::render(const LWData *data) const
+{
+    // room for the decorations
+    int left = 0, right = 0, top = 0, bottom = 0;
+    if (m_axes) {
+        left = AXIS_LEFT;
+        bottom = AXIS_BOTTOM;
+    }
+    if (m_colorbar)
+        right = BAR_GAP + BAR_WIDTH + BAR_LABELS;
+    if (m_axes || m_colorbar) {
+        top = MARGIN;
+        left = qMax(left, MARGIN);
+        right = qMax(right, MARGIN);
+        bottom = qMax(bottom, MARGIN);
+    }
+
+    QSize size = m_size;
+    if (size.isEmpty())
+        size = QSize(data->width() + left + right, data->height() + top + bottom);
+    QRect area(left, top, qMax(size.width() - left - right, 1),
+               qMax(size.height() - top - bottom, 1));
+    size = QSize(area.right() + 1 + right, area.bottom() + 1 + bottom);
+
+    QImage image(size, QImage::Format_ARGB32);
+    image.fill(QColor(Qt::white).rgba());
+
+    const QwtDoubleInterval range = rangeFor(data);
+    LWColorLut lut(*m_colormap, range);
+    if (data->width() > 0 && data->height() > 0 && data->currentLayer())
+        renderPixels(data, lut, range, image, area);
+    if (m_axes || m_colorbar)
+        renderFrame(data, lut, range, image, area);
+    return image;
+}
+
+void LWExporter::renderPixels(const LWData *data, const LWColorLut &lut,
+                              const QwtDoubleInterval &range, QImage &image,
+                              const QRect &area) const
+{
+    // the displayed values, like LWData::value()
+    if (!data->logImage().isEmpty())
+        colorPixels(data->logImage().constData(), false, data, lut, range,
+                    image, area);
+    else
+        colorPixels(data->currentLayer(), data->isLog10(), data, lut, range,
+                    image, area);
+}
+
+void LWExporter::renderFrame(const LWData *data, const QwtColorMap &lut,
+                             const QwtDoubleInterval &range, QImage &image,
+                             const QRect &area) const
+{
+    QPainter painter(&image);
+    QPalette palette;
+    palette.setColor(QPalette::Foreground, Qt::black);
+    palette.setColor(QPalette::Text, Qt::black);
+    QwtLinearScaleEngine engine;
+
+    if (m_axes) {
+        QwtScaleDraw xScale;
+        xScale.setAlignment(QwtScaleDraw::BottomScale);
+        xScale.setScaleDiv(engine.divideScale(0, data->width(), 8, 5));
+        xScale.move(area.left(), area.bottom() + 1);
+        xScale.setLength(area.width());
+        xScale.draw(&painter, palette);
+
+        QwtScaleDraw yScale;
+        yScale.setAlignment(QwtScaleDraw::LeftScale);
+        yScale.setScaleDiv(engine.divideScale(0, data->height(), 8, 5));
+        yScale.move(area.left() - 1, area.top());
+        yScale.setLength(area.height());
+        yScale.draw(&painter, palette);
+    }
+
+    if (m_colorbar) {
+        QRect bar(area.right() + 1 + BAR_GAP, area.top(), BAR_WIDTH, area.height());
+        for (int j = 0; j < bar.height(); ++j) {
+            double v = range.minValue() + range.width() *
+                (bar.height() - 1 - j) / qMax(bar.height() - 1, 1);
+            painter.fillRect(QRect(bar.left(), bar.top() + j, bar.width(), 1),
+                             QColor(lut.rgb(range, v)));
+        }
+
+        QwtScaleDraw barScale;
+        barScale.setAlignment(QwtScaleDraw::RightScale);
+        barScale.setScaleDiv(engine.divideScale(range.minValue(),
+                                                range.maxValue(), 8, 5));
+        barScale.move(bar.right() + 1, bar.top());
+        barScale.setLength(bar.height());
+        barScale.draw(&painter, palette);
+    }
+}
+
+bool LWExporter::save(const LWData *data, const QString &filename,
+                      const char *format) const
+{
+    if (!render(data).save(filename, format)) {
+        std::cerr << "could not write image " << filename.toLocal8Bit().constData()
+                  << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int LWExporter::saveFiles(const QStringList &filenames, const QString &outdir,
+                          const char *format, bool log10) const
+{
+    // files with the same base name from different directories get an
+    // index appended, so that no two threads write the same file
+    QMap<QString, int> uses;
+    for (int k = 0; k < filenames.size(); ++k)
+        uses[QFileInfo(filenames[k]).completeBaseName()]++;
+    QSet<QString> taken;
+    for (QMap<QString, int>::const_iterator it = uses.constBegin();
+         it != uses.constEnd(); ++it)
+        if (it.value() == 1)
+            taken.insert(it.key());
+    QStringList targets;
+    for (int k = 0; k < filenames.size(); ++k) {
+        QString name = QFileInfo(filenames[k]).completeBaseName();
+        if (uses[name] > 1) {
+            QString base = name;
+            for (int n = 1; taken.contains(name); ++n)
+                name = base + QString("_%1").arg(n);
+            taken.insert(name);
+        }
+        targets.append(QDir(outdir).filePath(name + "." + format));
+    }
+
+    QAtomicInt written(0);
+    FileExport exporter;
+    exporter.exporter = this;
+    exporter.filenames = &filenames;
+    exporter.targets = &targets;
+    exporter.format = QString(format);
+    exporter.log10 = log10;
+    exporter.written = &written;
+    lwParallelFor(filenames.size(), exporter, 1);
+    return written;
+}
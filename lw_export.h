@@ -0,0 +1,107 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#ifndef LW_EXPORT_H
+#define LW_EXPORT_H
+
+#include <QImage>
+#include <QRect>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+
+#include <qwt_color_map.h>
+#include <qwt_double_interval.h>
+
+#include "lw_common.h"
+#include "lw_data.h"
+
+class LWColorLut;
+
+
+/// Renders LWData into images without a plot widget, e.g. for exporting
+/// many frames from a script.
+///
+/// The image shows the current layer with the color map, at one image
+/// pixel per data pixel or scaled to a requested size, optionally framed
+/// by axes and a color bar.  render() only reads the data and can be used
+/// from any thread; saveFiles() exports a list of files in parallel.
+class LWExporter
+{
+  private:
+    QwtColorMap *m_colormap;
+    QSize m_size;  // invalid: native resolution
+    bool m_custom_range;
+    double m_range_min, m_range_max;
+    bool m_axes;
+    bool m_colorbar;
+
+    QwtDoubleInterval rangeFor(const LWData *data) const;
+    void renderPixels(const LWData *data, const LWColorLut &lut,
+                      const QwtDoubleInterval &range, QImage &image,
+                      const QRect &area) const;
+    void renderFrame(const LWData *data, const QwtColorMap &lut,
+                     const QwtDoubleInterval &range, QImage &image,
+                     const QRect &area) const;
+
+  public:
+    LWExporter();
+    LWExporter(const LWExporter &other);
+    LWExporter &operator=(const LWExporter &other);
+    ~LWExporter();
+
+    /// The color maps offered by LWWidget::setStandardColorMap.
+    static QwtLinearColorMap standardColorMap(bool grayscale, bool cyclic);
+
+    void setColorMap(const QwtColorMap &map);
+    void setStandardColorMap(bool grayscale, bool cyclic);
+
+    /// Size of the whole image; an empty size (default) gives one pixel
+    /// per data pixel, plus the room for axes and color bar.
+    QSize size() const { return m_size; }
+    void setSize(int width, int height);
+
+    /// Color range; by default the range the data would be displayed with.
+    bool hasCustomRange() const { return m_custom_range; }
+    void setCustomRange(double lower, double upper);
+    void clearCustomRange();
+
+    bool hasAxes() const { return m_axes; }
+    void setAxes(bool on);
+    bool hasColorBar() const { return m_colorbar; }
+    void setColorBar(bool on);
+
+    QImage render(const LWData *data) const;
+    /// Render and write the image; the format is guessed from the file
+    /// name if not given.
+    bool save(const LWData *data, const QString &filename,
+              const char *format = NULL) const;
+    /// Load each data file, render it and save it as "outdir/<name>.<format>"
+    /// in parallel; if several files have the same name, the later ones
+    /// are saved as "<name>_1", "<name>_2" and so on.  Returns the number
+    /// of images written.
+    int saveFiles(const QStringList &filenames, const QString &outdir,
+                  const char *format = "png", bool log10 = false) const;
+};
+
+#endif
@@ -0,0 +1,437 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fitsio.h>
+
+#include <QByteArray>
+#include <QFileInfo>
+#include <QMutexLocker>
+
+#include "lw_fits.h"
+
+
+static bool writeImage(const QString &filename, int width, int height,
+                       int bitpix, int datatype, const void *pixels,
+                       LWFitsCompression compression, QString *error)
+{
+    fitsfile *fptr = NULL;
+    int status = 0;
+    long dimensions[2] = {width, height};
+    QByteArray tmpname = (filename + ".part").toLocal8Bit();
+
+    if (width <= 0 || height <= 0 || !pixels) {
+        if (error)
+            *error = "no image data to write";
+        return false;
+    }
+
+    // the "!" prefix tells cfitsio to replace a leftover temporary file
+    if (fits_create_file(&fptr, ("!" + tmpname).constData(), &status))
+        goto fail;
+
+    // floats are not quantized, which would be lossy; cfitsio can only
+    // store them losslessly with GZIP, so Rice is replaced by that
+    if (compression == FitsRiceCompressed && bitpix != FLOAT_IMG)
+        fits_set_compression_type(fptr, RICE_1, &status);
+    else if (compression != FitsUncompressed)
+        fits_set_compression_type(fptr, GZIP_1, &status);
+    // one tile per row
+    if (compression != FitsUncompressed) {
+        long tile[2] = {width, 1};
+        fits_set_tile_dim(fptr, 2, tile, &status);
+        if (bitpix == FLOAT_IMG)
+            fits_set_quantize_level(fptr, 0.0, &status);
+    }
+
+    fits_create_img(fptr, bitpix, 2, dimensions, &status);
+    fits_write_img(fptr, datatype, 1, (LONGLONG)width * height,
+                   const_cast<void *>(pixels), &status);
+    fits_close_file(fptr, &status);
+    fptr = NULL;
+    if (status)
+        goto fail;
+
+    if (rename(tmpname.constData(), filename.toLocal8Bit().constData()) != 0) {
+        if (error)
+            *error = QString("could not rename %1: %2")
+                     .arg(filename + ".part").arg(strerror(errno));
+        remove(tmpname.constData());
+        return false;
+    }
+    return true;
+
+  fail:
+    if (error) {
+        char msg[FLEN_STATUS];
+        fits_get_errstatus(status, msg);
+        *error = msg;
+    }
+    if (fptr) {
+        int dummy = 0;
+        fits_close_file(fptr, &dummy);
+    }
+    remove(tmpname.constData());
+    return false;
+}
+
+
+LWFitsWriter::LWFitsWriter(QObject *parent, int maxPending, QueuePolicy policy)
+    : QThread(parent),
+      m_max_pending(maxPending > 0 ? maxPending : 1),
+      m_policy(policy),
+      m_dropped(0),
+      m_busy(false),
+      m_stop(false)
+{
+}
+
+LWFitsWriter::~LWFitsWriter()
+{
+    m_mutex.lock();
+    m_stop = true;
+    m_queued.wakeAll();
+    m_mutex.unlock();
+    wait();
+    // only left over if the thread never ran
+    qDeleteAll(m_queue);
+}
+
+bool LWFitsWriter::write(const QString &filename, int width, int height,
+                         const data_t *pixels, LWFitsCompression compression,
+                         QString *error)
+{
+    return writeImage(filename, width, height, ULONG_IMG, TUINT,
+                      pixels, compression, error);
+}
+
+bool LWFitsWriter::write(const QString &filename, int width, int height,
+                         const float *pixels, LWFitsCompression compression,
+                         QString *error)
+{
+    return writeImage(filename, width, height, FLOAT_IMG, TFLOAT,
+                      pixels, compression, error);
+}
+
+bool LWFitsWriter::save(const LWData *data, const QString &filename,
+                        LWFitsCompression compression)
+{
+    if (!data || !data->currentLayer())
+        return false;
+
+    // snapshot outside of the lock, the data may change after we return
+    Job *job = new Job;
+    job->filename = filename;
+    job->width = data->width();
+    job->height = data->height();
+    job->compression = compression;
+    job->pixels.assign(data->currentLayer(),
+                       data->currentLayer() + (size_t)job->width * job->height);
+
+    QMutexLocker locker(&m_mutex);
+    while (m_queue.size() >= m_max_pending) {
+        if (m_policy == Block) {
+            m_dequeued.wait(&m_mutex);
+        } else if (m_policy == DropOldest) {
+            delete m_queue.takeFirst();
+            m_dropped++;
+        } else {
+            delete job;
+            return false;
+        }
+    }
+    m_queue.append(job);
+    m_queued.wakeOne();
+    if (!isRunning())
+        start();
+    return true;
+}
+
+void LWFitsWriter::run()
+{
+    forever {
+        m_mutex.lock();
+        while (m_queue.isEmpty() && !m_stop)
+            m_queued.wait(&m_mutex);
+        if (m_queue.isEmpty()) {
+            m_mutex.unlock();
+            return;
+        }
+        Job *job = m_queue.takeFirst();
+        m_busy = true;
+        m_dequeued.wakeAll();
+        m_mutex.unlock();
+
+        QString error;
+        if (write(job->filename, job->width, job->height, &job->pixels[0],
+                  job->compression, &error))
+            emit saved(job->filename);
+        else
+            emit failed(job->filename, error);
+        delete job;
+
+        m_mutex.lock();
+        m_busy = false;
+        m_dequeued.wakeAll();
+        m_mutex.unlock();
+    }
+}
+
+int LWFitsWriter::maxPending() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_max_pending;
+}
+
+void LWFitsWriter::setMaxPending(int count)
+{
+    QMutexLocker locker(&m_mutex);
+    m_max_pending = count > 0 ? count : 1;
+    m_dequeued.wakeAll();
+}
+
+LWFitsWriter::QueuePolicy LWFitsWriter::queuePolicy() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_policy;
+}
+
+void LWFitsWriter::setQueuePolicy(QueuePolicy policy)
+{
+    QMutexLocker locker(&m_mutex);
+    m_policy = policy;
+    m_dequeued.wakeAll();
+}
+
+int LWFitsWriter::pending() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_queue.size() + (m_busy ? 1 : 0);
+}
+
+int LWFitsWriter::dropped() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_dropped;
+}
+
+void LWFitsWriter::flush()
+{
+    QMutexLocker locker(&m_mutex);
+    while (!m_queue.isEmpty() || m_busy)
+        m_dequeued.wait(&m_mutex);
+}
+
+
+QMutex LWFitsHeader::s_lock;
+QHash<QString, LWFitsHeader::Entry> LWFitsHeader::s_cache;
+QList<QString> LWFitsHeader::s_order;
+int LWFitsHeader::s_max_files = 1024;
+
+static QString normalizedKey(const QString &key)
+{
+    QString result = key.trimmed().toUpper();
+    if (result.startsWith("HIERARCH "))
+        result = result.mid(9).trimmed();
+    return result;
+}
+
+static QString unquoted(const char *value)
+{
+    QString result = value;
+    int first = result.indexOf('\'');
+    int last = result.lastIndexOf('\'');
+    if (first < 0 || last <= first)
+        return result.trimmed();
+    result = result.mid(first + 1, last - first - 1).replace("''", "'");
+    // trailing blanks in FITS strings are not significant
+    while (result.endsWith(' '))
+        result.chop(1);
+    return result;
+}
+
+bool LWFitsHeader::parse(const QString &filename, Entry &entry)
+{
+    fitsfile *fptr;
+    int status = 0;
+    int nkeys = 0;
+    char card[FLEN_CARD];
+    char name[FLEN_KEYWORD];
+    char value[FLEN_VALUE];
+    char comment[FLEN_COMMENT];
+    QString last;
+
+    if (fits_open_file(&fptr, filename.toLocal8Bit().constData(),
+                       READONLY, &status))
+        return false;
+    fits_get_hdrspace(fptr, &nkeys, NULL, &status);
+
+    for (int i = 1; i <= nkeys && !status; ++i) {
+        if (fits_read_record(fptr, i, card, &status))
+            break;
+
+        int keyclass = fits_get_keyclass(card);
+        if (keyclass == TYP_COMM_KEY)
+            continue;
+        if (keyclass == TYP_CONT_KEY) {
+            // long string value, continued from the previous card
+            QString prev = entry.cards.value(last).toString();
+            if (!last.isEmpty() && prev.endsWith('&')) {
+                prev.chop(1);
+                entry.cards[last] = prev + unquoted(card + 8);
+            }
+            continue;
+        }
+
+        // a malformed card shouldn't spoil the rest of the header
+        int keystatus = 0;
+        int length;
+        char dtype;
+        if (fits_get_keyname(card, name, &length, &keystatus) ||
+            fits_parse_value(card, value, comment, &keystatus))
+            continue;
+
+        QString key = normalizedKey(name);
+        QVariant parsed;
+        if (value[0] && !fits_get_keytype(value, &dtype, &keystatus)) {
+            bool ok;
+            switch (dtype) {
+            case 'C':
+                parsed = unquoted(value);
+                break;
+            case 'L':
+                parsed = (value[0] == 'T');
+                break;
+            case 'I':
+                parsed = QString(value).toLongLong(&ok);
+                if (!ok)
+                    parsed = QString(value).toDouble();
+                break;
+            case 'F':
+                // Fortran style exponents like 1.0D+03
+                parsed = QString(value).replace('D', 'E').toDouble();
+                break;
+            default:
+                parsed = QString(value).trimmed();
+            }
+        }
+        entry.cards.insert(key, parsed);
+        if (strncmp(card, "HIERARCH ", 9) == 0)
+            entry.hierarch.insert(key);
+        last = key;
+    }
+
+    fits_close_file(fptr, &status);
+    return status == 0;
+}
+
+bool LWFitsHeader::lookup(const QString &filename, Entry &entry)
+{
+    QFileInfo info(filename);
+    // extended file names like "file.fits[1]" are parsed, but not cached
+    bool cacheable = info.exists();
+    QString path = cacheable ? info.absoluteFilePath() : filename;
+
+    if (cacheable) {
+        QMutexLocker locker(&s_lock);
+        QHash<QString, Entry>::const_iterator it = s_cache.constFind(path);
+        if (it != s_cache.constEnd() && it.value().mtime == info.lastModified() &&
+            it.value().size == info.size()) {
+            entry = it.value();
+            return true;
+        }
+    }
+
+    // parse without holding the lock, other files can be looked up meanwhile
+    if (!parse(filename, entry))
+        return false;
+    entry.mtime = info.lastModified();
+    entry.size = info.size();
+
+    if (cacheable) {
+        QMutexLocker locker(&s_lock);
+        if (!s_cache.contains(path))
+            s_order.append(path);
+        s_cache.insert(path, entry);
+        while (s_order.size() > s_max_files)
+            s_cache.remove(s_order.takeFirst());
+    }
+    return true;
+}
+
+QVariantMap LWFitsHeader::cards(const QString &filename)
+{
+    Entry entry;
+    if (!lookup(filename, entry))
+        return QVariantMap();
+    return entry.cards;
+}
+
+QVariantMap LWFitsHeader::query(const QString &filename, const QStringList &keys)
+{
+    QVariantMap result;
+    Entry entry;
+    if (!lookup(filename, entry))
+        return result;
+    for (int i = 0; i < keys.size(); ++i) {
+        QVariantMap::const_iterator it = entry.cards.constFind(normalizedKey(keys[i]));
+        if (it != entry.cards.constEnd())
+            result.insert(keys[i], it.value());
+    }
+    return result;
+}
+
+QVariant LWFitsHeader::value(const QString &filename, const QString &key,
+                             const QVariant &defaultValue)
+{
+    Entry entry;
+    if (!lookup(filename, entry))
+        return defaultValue;
+    return entry.cards.value(normalizedKey(key), defaultValue);
+}
+
+bool LWFitsHeader::isHierarch(const QString &filename, const QString &key)
+{
+    Entry entry;
+    if (!lookup(filename, entry))
+        return false;
+    return entry.hierarch.contains(normalizedKey(key));
+}
+
+void LWFitsHeader::setCacheSize(int files)
+{
+    QMutexLocker locker(&s_lock);
+    s_max_files = files > 0 ? files : 0;
+    while (s_order.size() > s_max_files)
+        s_cache.remove(s_order.takeFirst());
+}
+
+void LWFitsHeader::clearCache()
+{
+    QMutexLocker locker(&s_lock);
+    s_cache.clear();
+    s_order.clear();
+}
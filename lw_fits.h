@@ -0,0 +1,162 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#ifndef LW_FITS_H
+#define LW_FITS_H
+
+#include <vector>
+
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+#include <QVariant>
+#include <QWaitCondition>
+
+#include "lw_common.h"
+#include "lw_data.h"
+
+
+/// Writes FITS images on a background thread.
+///
+/// save() copies the current layer of the data and returns immediately;
+/// the file is written by the writer thread, and saved() or failed() is
+/// emitted when it is done.  At most maxPending() images are queued, what
+/// happens to further images is decided by the queue policy.
+class LWFitsWriter : public QThread
+{
+    Q_OBJECT
+
+  public:
+    enum QueuePolicy {
+        Block,       // save() waits until a queue slot is free
+        DropOldest,  // the oldest queued image is discarded
+        Reject       // save() returns false
+    };
+
+  private:
+    struct Job {
+        QString filename;
+        int width, height;
+        LWFitsCompression compression;
+        std::vector<data_t> pixels;
+    };
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_queued;
+    QWaitCondition m_dequeued;
+    QList<Job *> m_queue;
+    int m_max_pending;
+    QueuePolicy m_policy;
+    int m_dropped;
+    bool m_busy;
+    bool m_stop;
+
+  protected:
+    virtual void run();
+
+  public:
+    LWFitsWriter(QObject *parent = NULL, int maxPending = 4,
+                 QueuePolicy policy = Block);
+    /// Writes all queued images before returning.
+    virtual ~LWFitsWriter();
+
+    /// Write a 2D image of uint32 (ULONG_IMG) or float (FLOAT_IMG) values.
+    /// An existing file is replaced; the image is written to a temporary
+    /// file first, so that readers never see a partially written file.
+    /// Floats are compressed losslessly, with GZIP also if Rice is asked
+    /// for.
+    static bool write(const QString &filename, int width, int height,
+                      const data_t *pixels, LWFitsCompression compression,
+                      QString *error = NULL);
+    static bool write(const QString &filename, int width, int height,
+                      const float *pixels, LWFitsCompression compression,
+                      QString *error = NULL);
+
+    /// Queue the current layer of the (processed) data for writing.
+    bool save(const LWData *data, const QString &filename,
+              LWFitsCompression compression = FitsUncompressed);
+
+    int maxPending() const;
+    void setMaxPending(int count);
+    QueuePolicy queuePolicy() const;
+    void setQueuePolicy(QueuePolicy policy);
+
+    /// Number of images waiting to be written.
+    int pending() const;
+    /// Number of images discarded by the DropOldest policy.
+    int dropped() const;
+    /// Block until all queued images are written.
+    void flush();
+
+  signals:
+    void saved(const QString &filename);
+    void failed(const QString &filename, const QString &error);
+};
+
+
+/// Keyword access for the primary header of FITS files.
+///
+/// The whole header is parsed at once into typed values (integers become
+/// qlonglong, floats double, logicals bool and strings QString; HIERARCH
+/// keywords are stored without the "HIERARCH " prefix).  Parsed headers are
+/// cached per file and reused as long as the file's modification time and
+/// size do not change.  Keywords are matched case-insensitively.
+class LWFitsHeader
+{
+  private:
+    struct Entry {
+        QDateTime mtime;
+        qint64 size;
+        QVariantMap cards;
+        QSet<QString> hierarch;
+    };
+
+    static QMutex s_lock;
+    static QHash<QString, Entry> s_cache;
+    static QList<QString> s_order;
+    static int s_max_files;
+
+    static bool parse(const QString &filename, Entry &entry);
+    static bool lookup(const QString &filename, Entry &entry);
+
+  public:
+    /// All keywords of the file; empty if it can't be read.
+    static QVariantMap cards(const QString &filename);
+    /// Values of the given keywords; missing keywords are left out.
+    static QVariantMap query(const QString &filename, const QStringList &keys);
+    static QVariant value(const QString &filename, const QString &key,
+                          const QVariant &defaultValue = QVariant());
+    /// True if the keyword was written as a HIERARCH card.
+    static bool isHierarch(const QString &filename, const QString &key);
+
+    /// Number of parsed headers kept in the cache (default 1024).
+    static void setCacheSize(int files);
+    static void clearCache();
+};
+
+#endif
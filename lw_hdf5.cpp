@@ -0,0 +1,274 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#ifdef HAVE_HDF5
+
+#include <iostream>
+#include <string.h>
+
+#include <QMutexLocker>
+#include <QtConcurrentRun>
+
+#include "lw_hdf5.h"
+
+
+QMutex LWHdf5Source::s_lock;
+
+// usual locations of the detector data in NeXus files written by NICOS
+static const char *default_paths[] = {
+    "/entry/data/data",
+    "/entry/instrument/detector/data",
+    "/entry1/data1/counts",
+    NULL
+};
+
+struct DatasetSearch
+{
+    std::string path;
+    hsize_t npoints;
+};
+
+static herr_t visitLink(hid_t group, const char *name, const H5L_info_t *info,
+                        void *op_data)
+{
+    DatasetSearch *search = (DatasetSearch *)op_data;
+    if (info->type != H5L_TYPE_HARD)
+        return 0;
+
+    hid_t obj;
+    H5E_BEGIN_TRY {
+        obj = H5Oopen(group, name, H5P_DEFAULT);
+    } H5E_END_TRY;
+    if (obj < 0)
+        return 0;
+    if (H5Iget_type(obj) == H5I_DATASET) {
+        hid_t space = H5Dget_space(obj);
+        hid_t type = H5Dget_type(obj);
+        int rank = H5Sget_simple_extent_ndims(space);
+        H5T_class_t cls = H5Tget_class(type);
+        hsize_t npoints = H5Sget_simple_extent_npoints(space);
+        if ((rank == 2 || rank == 3) &&
+            (cls == H5T_INTEGER || cls == H5T_FLOAT) &&
+            npoints > search->npoints) {
+            search->path = std::string("/") + name;
+            search->npoints = npoints;
+        }
+        H5Tclose(type);
+        H5Sclose(space);
+    }
+    H5Oclose(obj);
+    return 0;
+}
+
+// smallest prime >= n, as recommended for the number of chunk cache slots
+static size_t nextPrime(size_t n)
+{
+    for (;; n++) {
+        bool prime = n > 1;
+        for (size_t d = 2; d * d <= n && prime; d++)
+            prime = n % d != 0;
+        if (prime)
+            return n;
+    }
+}
+
+LWHdf5Source::LWHdf5Source()
+    : m_file(-1),
+      m_dset(-1),
+      m_width(0),
+      m_height(0),
+      m_depth(0),
+      m_pending_z(-1),
+      m_pending_ok(false)
+{
+}
+
+LWHdf5Source::~LWHdf5Source()
+{
+    m_prefetch.waitForFinished();
+    close();
+}
+
+void LWHdf5Source::close()
+{
+    QMutexLocker locker(&s_lock);
+    if (m_dset >= 0)
+        H5Dclose(m_dset);
+    if (m_file >= 0)
+        H5Fclose(m_file);
+    m_dset = m_file = -1;
+}
+
+bool LWHdf5Source::findDataset(std::string &path)
+{
+    for (const char **p = default_paths; *p; p++) {
+        htri_t exists;
+        H5E_BEGIN_TRY {
+            exists = H5Lexists(m_file, *p, H5P_DEFAULT);
+        } H5E_END_TRY;
+        if (exists > 0) {
+            path = *p;
+            return true;
+        }
+    }
+    DatasetSearch search;
+    search.npoints = 0;
+    H5Lvisit(m_file, H5_INDEX_NAME, H5_ITER_NATIVE, visitLink, &search);
+    path = search.path;
+    return search.npoints > 0;
+}
+
+bool LWHdf5Source::open(const char *filename, const char *path)
+{
+    QMutexLocker locker(&s_lock);
+    htri_t ishdf5;
+
+    H5E_BEGIN_TRY {
+        ishdf5 = H5Fis_hdf5(filename);
+    } H5E_END_TRY;
+    if (ishdf5 <= 0)
+        return false;
+
+    m_file = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (m_file < 0) {
+        std::cerr << "Could not open HDF5 file " << filename << std::endl;
+        return false;
+    }
+
+    std::string dpath = path ? path : "";
+    if (dpath.empty() && !findDataset(dpath)) {
+        std::cerr << "No image dataset found in " << filename << std::endl;
+        locker.unlock();
+        close();
+        return false;
+    }
+
+    H5E_BEGIN_TRY {
+        m_dset = H5Dopen2(m_file, dpath.c_str(), H5P_DEFAULT);
+    } H5E_END_TRY;
+    if (m_dset < 0) {
+        std::cerr << "Could not open dataset " << dpath << " in "
+                  << filename << std::endl;
+        locker.unlock();
+        close();
+        return false;
+    }
+
+    hid_t space = H5Dget_space(m_dset);
+    int rank = H5Sget_simple_extent_ndims(space);
+    hsize_t dims[3] = {1, 1, 1};
+    if (rank == 2 || rank == 3)
+        H5Sget_simple_extent_dims(space, dims + 3 - rank, NULL);
+    H5Sclose(space);
+    if (rank != 2 && rank != 3) {
+        std::cerr << "Dataset " << dpath << " is not 2D or 3D" << std::endl;
+        locker.unlock();
+        close();
+        return false;
+    }
+    m_depth = dims[0];
+    m_height = dims[1];
+    m_width = dims[2];
+
+    // size the chunk cache to hold all chunks that make up one frame
+    // (the default of 1 MB is much smaller than a detector frame, which
+    // makes HDF5 decompress chunks over and over again)
+    hid_t dcpl = H5Dget_create_plist(m_dset);
+    if (H5Pget_layout(dcpl) == H5D_CHUNKED) {
+        hsize_t chunk[3] = {1, 1, 1};
+        H5Pget_chunk(dcpl, rank, chunk + 3 - rank);
+        hid_t type = H5Dget_type(m_dset);
+        size_t chunkbytes = chunk[0] * chunk[1] * chunk[2] * H5Tget_size(type);
+        size_t nchunks = ((m_height + chunk[1] - 1) / chunk[1]) *
+            ((m_width + chunk[2] - 1) / chunk[2]);
+        H5Tclose(type);
+
+        hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+        // chunks are read completely when a frame is read, so evict
+        // fully read chunks first
+        H5Pset_chunk_cache(dapl, nextPrime(100 * nchunks),
+                           nchunks * chunkbytes, 1.0);
+        H5Dclose(m_dset);
+        m_dset = H5Dopen2(m_file, dpath.c_str(), dapl);
+        H5Pclose(dapl);
+    }
+    H5Pclose(dcpl);
+    return m_dset >= 0;
+}
+
+bool LWHdf5Source::_read(int z, data_t *dest)
+{
+    QMutexLocker locker(&s_lock);
+
+    hid_t filespace = H5Dget_space(m_dset);
+    int rank = H5Sget_simple_extent_ndims(filespace);
+    hsize_t start[3] = {(hsize_t)z, 0, 0};
+    hsize_t count[3] = {1, (hsize_t)m_height, (hsize_t)m_width};
+    H5Sselect_hyperslab(filespace, H5S_SELECT_SET, start + 3 - rank, NULL,
+                        count + 3 - rank, NULL);
+    hid_t memspace = H5Screate_simple(2, count + 1, NULL);
+
+    // HDF5 converts any integer or float type to our pixel type
+    herr_t status = H5Dread(m_dset, H5T_NATIVE_UINT32, memspace, filespace,
+                            H5P_DEFAULT, dest);
+    H5Sclose(memspace);
+    H5Sclose(filespace);
+    if (status < 0) {
+        std::cerr << "Could not read layer " << z << " from HDF5 dataset"
+                  << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void LWHdf5Source::_prefetch()
+{
+    m_pending_ok = _read(m_pending_z, &m_pending[0]);
+}
+
+bool LWHdf5Source::readLayer(int z, data_t *dest)
+{
+    if (z < 0 || z >= m_depth)
+        return false;
+    if (z == m_pending_z) {
+        m_prefetch.waitForFinished();
+        if (m_pending_ok) {
+            memcpy(dest, &m_pending[0], sizeof(data_t) * m_width * m_height);
+            return true;
+        }
+    }
+    return _read(z, dest);
+}
+
+void LWHdf5Source::prefetch(int z)
+{
+    if (z < 0 || z >= m_depth || z == m_pending_z)
+        return;
+    m_prefetch.waitForFinished();
+    m_pending.resize((size_t)m_width * m_height);
+    m_pending_z = z;
+    m_pending_ok = false;
+    m_prefetch = QtConcurrent::run(this, &LWHdf5Source::_prefetch);
+}
+
+#endif
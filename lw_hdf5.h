@@ -0,0 +1,82 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#ifndef LW_HDF5_H
+#define LW_HDF5_H
+
+#ifdef HAVE_HDF5
+
+#include <string>
+#include <vector>
+
+#include <hdf5.h>
+
+#include <QFuture>
+#include <QMutex>
+
+#include "lw_storage.h"
+
+
+/// Reads 2D or 3D detector datasets from (NeXus) HDF5 files one layer at a
+/// time.  Only the hyperslab of the requested layer is read; the chunk cache
+/// of the dataset is sized to hold the chunks of one frame, and the next
+/// frame can be decompressed in the background while the current one is
+/// displayed.
+class LWHdf5Source : public LWLayerSource
+{
+  private:
+    hid_t m_file;
+    hid_t m_dset;
+    int m_width, m_height, m_depth;
+
+    // the HDF5 library is not thread safe, all calls go through this lock
+    static QMutex s_lock;
+
+    QFuture<void> m_prefetch;
+    int m_pending_z;
+    bool m_pending_ok;
+    std::vector<data_t> m_pending;
+
+    bool findDataset(std::string &path);
+    bool _read(int z, data_t *dest);
+    void _prefetch();
+    void close();
+
+  public:
+    LWHdf5Source();
+    virtual ~LWHdf5Source();
+
+    /// Open the dataset at "path" in the file, or the largest 2D/3D
+    /// numeric dataset if path is empty.
+    bool open(const char *filename, const char *path);
+
+    virtual int width() const { return m_width; }
+    virtual int height() const { return m_height; }
+    virtual int depth() const { return m_depth; }
+    virtual bool readLayer(int z, data_t *dest);
+    virtual void prefetch(int z);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,323 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+#include <string.h>
+
+#include <QThread>
+
+#include "lw_integrate.h"
+#include "lw_parallel.h"
+
+
+namespace {
+
+/// One part of a pixel that falls into a bin.
+struct MapEntry {
+    int bin;
+    qint32 pixel;
+    float weight;
+};
+
+/// Bins the pixels of a band of rows; each band collects its own entries,
+/// in pixel order.
+struct MapRows {
+    LWIntegrationMode mode;
+    double cx, cy;
+    const double *edges;
+    int nedges;
+    double rmin, rmax, chimin, chimax;
+    int split;
+    int width, height, nbands;
+    const char *mask;  // NULL or width * height
+    QVector<MapEntry> *entries;  // per band
+
+    void operator()(int begin, int end) const {
+        const double step = 1. / split, weight = step * step;
+        QVector<MapEntry> parts;
+        // keeps the allocation when resized to 0
+        parts.reserve(split * split);
+        for (int b = begin; b < end; ++b) {
+            QVector<MapEntry> &out = entries[b];
+            int y0 = (int)((qint64)height * b / nbands);
+            int y1 = (int)((qint64)height * (b + 1) / nbands);
+            for (int y = y0; y < y1; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    qint32 pixel = y * width + x;
+                    if (mask && mask[pixel])
+                        continue;
+                    // bin the parts, merging those in the same bin
+                    parts.resize(0);
+                    for (int j = 0; j < split; ++j) {
+                        double dy = y + (j + 0.5) * step - cy;
+                        for (int i = 0; i < split; ++i) {
+                            double dx = x + (i + 0.5) * step - cx;
+                            double r = sqrt(dx*dx + dy*dy);
+                            double chi = atan2(dy, dx) * (180. / M_PI);
+                            if (chi >= 180.)
+                                chi -= 360.;
+                            if (r < rmin || r >= rmax ||
+                                chi < chimin || chi >= chimax)
+                                continue;
+                            double v = mode == IntegrateRadial ? r : chi;
+                            int bin = int(std::upper_bound(edges, edges + nedges, v)
+                                          - edges) - 1;
+                            if (bin < 0 || bin >= nedges - 1)
+                                continue;
+                            int k = 0;
+                            while (k < parts.size() && parts[k].bin != bin)
+                                ++k;
+                            if (k == parts.size()) {
+                                MapEntry entry;
+                                entry.bin = bin;
+                                entry.pixel = pixel;
+                                entry.weight = 0;
+                                parts.append(entry);
+                            }
+                            parts[k].weight += weight;
+                        }
+                    }
+                    for (int k = 0; k < parts.size(); ++k)
+                        out.append(parts[k]);
+                }
+            }
+        }
+    }
+};
+
+/// Sums the map rows of a range of bins.
+struct BinSums {
+    const data_t *source;
+    const int *rowStart;
+    const qint32 *pixels;
+    const float *weights;
+    const double *norm;
+    double *sums, *intensities;
+
+    void operator()(int begin, int end) const {
+        for (int bin = begin; bin < end; ++bin) {
+            double sum = 0;
+            for (int k = rowStart[bin]; k < rowStart[bin + 1]; ++k)
+                sum += weights[k] * (double)source[pixels[k]];
+            sums[bin] = sum;
+            intensities[bin] = norm[bin] > 0 ? sum / norm[bin] : 0;
+        }
+    }
+};
+
+}
+
+
+LWRadialIntegrator::LWRadialIntegrator()
+    : m_mode(IntegrateRadial),
+      m_cx(0), m_cy(0),
+      m_split(1),
+      m_mask_width(0), m_mask_height(0),
+      m_valid(false),
+      m_width(0), m_height(0)
+{
+    clearRanges();
+    setBins(0, 100, 100);
+}
+
+void LWRadialIntegrator::setMode(LWIntegrationMode mode)
+{
+    m_mode = mode;
+    m_valid = false;
+}
+
+void LWRadialIntegrator::setCenter(double x, double y)
+{
+    m_cx = x;
+    m_cy = y;
+    m_valid = false;
+}
+
+void LWRadialIntegrator::setBins(double lower, double upper, int count)
+{
+    count = qMax(count, 1);
+    m_edges.resize(count + 1);
+    for (int i = 0; i <= count; ++i)
+        m_edges[i] = lower + (upper - lower) * i / count;
+    m_valid = false;
+}
+
+bool LWRadialIntegrator::setBinEdges(const QVector<double> &edges)
+{
+    if (edges.size() < 2) {
+        std::cerr << "need at least two bin edges" << std::endl;
+        return false;
+    }
+    for (int i = 1; i < edges.size(); ++i) {
+        if (!(edges[i] > edges[i - 1])) {
+            std::cerr << "bin edges must be ascending" << std::endl;
+            return false;
+        }
+    }
+    m_edges = edges;
+    m_valid = false;
+    return true;
+}
+
+QVector<double> LWRadialIntegrator::binCenters() const
+{
+    QVector<double> centers(m_edges.size() - 1);
+    for (int i = 0; i < centers.size(); ++i)
+        centers[i] = (m_edges[i] + m_edges[i + 1]) / 2;
+    return centers;
+}
+
+void LWRadialIntegrator::setRadialRange(double rmin, double rmax)
+{
+    m_rmin = rmin;
+    m_rmax = rmax;
+    m_valid = false;
+}
+
+void LWRadialIntegrator::setAzimuthalRange(double chimin, double chimax)
+{
+    m_chimin = chimin;
+    m_chimax = chimax;
+    m_valid = false;
+}
+
+void LWRadialIntegrator::clearRanges()
+{
+    m_rmin = 0;
+    m_rmax = HUGE_VAL;
+    m_chimin = -180;
+    m_chimax = 180;
+    m_valid = false;
+}
+
+void LWRadialIntegrator::setPixelSplitting(int n)
+{
+    m_split = qBound(1, n, 16);
+    m_valid = false;
+}
+
+bool LWRadialIntegrator::setMask(int width, int height, const QByteArray &mask)
+{
+    if (width <= 0 || height <= 0 || mask.size() != width * height) {
+        std::cerr << "mask must have width x height bytes" << std::endl;
+        return false;
+    }
+    m_mask_width = width;
+    m_mask_height = height;
+    m_mask.resize(mask.size());
+    memcpy(m_mask.data(), mask.constData(), mask.size());
+    m_valid = false;
+    return true;
+}
+
+void LWRadialIntegrator::clearMask()
+{
+    m_mask.clear();
+    m_mask_width = m_mask_height = 0;
+    m_valid = false;
+}
+
+void LWRadialIntegrator::buildMap(int width, int height)
+{
+    m_width = width;
+    m_height = height;
+    m_valid = true;
+    const int nbins = m_edges.size() - 1;
+
+    const char *mask = NULL;
+    if (!m_mask.isEmpty()) {
+        if (m_mask_width == width && m_mask_height == height)
+            mask = m_mask.constData();
+        else
+            std::cerr << "mask size does not match the data, ignored" << std::endl;
+    }
+
+    int nbands = qMin(4 * qMax(QThread::idealThreadCount(), 1), qMax(height, 1));
+    QVector<QVector<MapEntry> > entries(nbands);
+    MapRows rows;
+    rows.mode = m_mode;
+    rows.cx = m_cx;
+    rows.cy = m_cy;
+    rows.edges = m_edges.constData();
+    rows.nedges = m_edges.size();
+    rows.rmin = m_rmin;
+    rows.rmax = m_rmax;
+    rows.chimin = m_chimin;
+    rows.chimax = m_chimax;
+    rows.split = m_split;
+    rows.width = width;
+    rows.height = height;
+    rows.nbands = nbands;
+    rows.mask = mask;
+    rows.entries = entries.data();
+    lwParallelFor(nbands, rows, 1);
+
+    // sort the entries into rows per bin
+    m_row_start.fill(0, nbins + 1);
+    for (int b = 0; b < nbands; ++b)
+        for (int k = 0; k < entries[b].size(); ++k)
+            m_row_start[entries[b][k].bin + 1]++;
+    for (int bin = 0; bin < nbins; ++bin)
+        m_row_start[bin + 1] += m_row_start[bin];
+    m_pixels.resize(m_row_start[nbins]);
+    m_weights.resize(m_row_start[nbins]);
+    m_norm.fill(0, nbins);
+    QVector<int> fill = m_row_start;
+    for (int b = 0; b < nbands; ++b) {
+        for (int k = 0; k < entries[b].size(); ++k) {
+            const MapEntry &entry = entries[b][k];
+            int pos = fill[entry.bin]++;
+            m_pixels[pos] = entry.pixel;
+            m_weights[pos] = entry.weight;
+            m_norm[entry.bin] += entry.weight;
+        }
+    }
+}
+
+const QVector<double> &LWRadialIntegrator::integrate(const LWData *data)
+{
+    if (!m_valid || data->width() != m_width || data->height() != m_height)
+        buildMap(data->width(), data->height());
+
+    const int nbins = m_edges.size() - 1;
+    m_sums.resize(nbins);
+    m_intensities.resize(nbins);
+    if (!data->currentLayer()) {
+        m_sums.fill(0);
+        m_intensities.fill(0);
+        return m_intensities;
+    }
+
+    BinSums bins;
+    bins.source = data->currentLayer();
+    bins.rowStart = m_row_start.constData();
+    bins.pixels = m_pixels.constData();
+    bins.weights = m_weights.constData();
+    bins.norm = m_norm.constData();
+    bins.sums = m_sums.data();
+    bins.intensities = m_intensities.data();
+    lwParallelFor(nbins, bins, 8);
+    return m_intensities;
+}
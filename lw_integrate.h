@@ -0,0 +1,117 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#ifndef LW_INTEGRATE_H
+#define LW_INTEGRATE_H
+
+#include <QByteArray>
+#include <QVector>
+
+#include "lw_common.h"
+#include "lw_data.h"
+
+
+/// Integration of the current layer over rings (I(r)) or sectors (I(chi))
+/// around a center, e.g. the beam position on a SANS or Laue detector.
+///
+/// The contribution of every pixel to every bin is computed once per
+/// geometry (center, bin edges, ranges, splitting, mask and data size) and
+/// kept as a sparse matrix in compressed rows, one row per bin.  A frame
+/// is then integrated by one pass over that matrix, in parallel over the
+/// bins.  With pixel splitting, each pixel is divided into n x n parts that
+/// are binned separately, which smoothes the curves for small radii.
+///
+/// Radii are in pixels, angles in degrees in [-180, 180), counterclockwise
+/// from the +x axis.
+class LWRadialIntegrator
+{
+  private:
+    LWIntegrationMode m_mode;
+    double m_cx, m_cy;
+    QVector<double> m_edges;
+    double m_rmin, m_rmax;
+    double m_chimin, m_chimax;
+    int m_split;
+    int m_mask_width, m_mask_height;
+    QVector<char> m_mask;
+
+    // the pixel -> bin map, valid for this data size
+    bool m_valid;
+    int m_width, m_height;
+    QVector<int> m_row_start;  // per bin, into m_pixels and m_weights
+    QVector<qint32> m_pixels;
+    QVector<float> m_weights;
+    QVector<double> m_norm;    // sum of the weights of each bin
+
+    QVector<double> m_sums;
+    QVector<double> m_intensities;
+
+    void buildMap(int width, int height);
+
+  public:
+    LWRadialIntegrator();
+
+    LWIntegrationMode mode() const { return m_mode; }
+    void setMode(LWIntegrationMode mode);
+
+    double centerX() const { return m_cx; }
+    double centerY() const { return m_cy; }
+    /// Center in data coordinates (pixel (i, j) covers [i, i+1) x [j, j+1)).
+    void setCenter(double x, double y);
+
+    /// "count" bins of equal width from "lower" to "upper", radii or
+    /// angles depending on the mode.
+    void setBins(double lower, double upper, int count);
+    /// Arbitrary ascending bin edges, one more than bins.
+    bool setBinEdges(const QVector<double> &edges);
+    const QVector<double> &binEdges() const { return m_edges; }
+    QVector<double> binCenters() const;
+
+    /// Only use pixels within these radii, resp. angles; by default all.
+    void setRadialRange(double rmin, double rmax);
+    void setAzimuthalRange(double chimin, double chimax);
+    void clearRanges();
+
+    /// Divide each pixel into n x n parts (default 1, no splitting).
+    int pixelSplitting() const { return m_split; }
+    void setPixelSplitting(int n);
+
+    /// Exclude the pixels whose byte in "mask" is not zero.  The mask
+    /// must have width x height bytes.
+    bool setMask(int width, int height, const QByteArray &mask);
+    void clearMask();
+
+    /// Integrate the current layer of "data": the mean counts per unit of
+    /// pixel area in each bin, or 0 for bins without pixels.
+    const QVector<double> &integrate(const LWData *data);
+    /// Results of the last integrate().
+    const QVector<double> &intensities() const { return m_intensities; }
+    /// Sums of the (split) counts in each bin.
+    const QVector<double> &sums() const { return m_sums; }
+    /// Pixel area in each bin.
+    const QVector<double> &areas() const { return m_norm; }
+    /// Number of nonzero entries of the pixel -> bin map.
+    int mapSize() const { return m_pixels.size(); }
+};
+
+#endif
@@ -0,0 +1,68 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#ifndef LW_PARALLEL_H
+#define LW_PARALLEL_H
+
+#include <QThread>
+#include <QVector>
+#include <QtConcurrentMap>
+
+
+struct LWChunk {
+    int begin;
+    int end;
+};
+
+template <class F>
+struct LWChunkCaller {
+    typedef void result_type;
+    const F *func;
+    void operator()(const LWChunk &chunk) const { (*func)(chunk.begin, chunk.end); }
+};
+
+/// Call func(begin, end) for consecutive chunks of the range [0, count) on
+/// the global thread pool, and return when all chunks are done.  Chunks
+/// have at least "grain" elements; small ranges run in the calling thread.
+/// func must be safe to call concurrently for disjoint chunks.
+template <class F>
+void lwParallelFor(int count, const F &func, int grain = 16)
+{
+    int nchunks = qMin(count / qMax(grain, 1), 4 * QThread::idealThreadCount());
+    if (nchunks < 2) {
+        if (count > 0)
+            func(0, count);
+        return;
+    }
+
+    QVector<LWChunk> chunks(nchunks);
+    for (int i = 0; i < nchunks; ++i) {
+        chunks[i].begin = (int)((qint64)count * i / nchunks);
+        chunks[i].end = (int)((qint64)count * (i + 1) / nchunks);
+    }
+    LWChunkCaller<F> caller;
+    caller.func = &func;
+    QtConcurrent::blockingMap(chunks, caller);
+}
+
+#endif
@@ -27,6 +27,7 @@
 #include <QFileDialog>
 
 #include "lw_plot.h"
+#include "lw_pyramid.h"
 
 
 /** LWZoomer ******************************************************************/
@@ -102,8 +103,10 @@ QwtText LWZoomer::trackerText(const QwtDoublePoint &pos) const
 
 /** LWPlot *********************************************************************/
 
-LWPlot::LWPlot(QWidget *parent) : QwtPlot(parent), m_spectro(0), m_panner(0),
+LWPlot::LWPlot(QWidget *parent) : QwtPlot(parent), m_spectro(0), m_contour(0),
+                                  m_panner(0),
                                   m_picker(0), m_rescaler(0), m_zoomer(0),
+                                  m_colormap(0), m_lut_log10(false),
                                   m_scale_width(0), m_scale_height(0)
 {
     initPlot();
@@ -112,6 +115,7 @@ LWPlot::LWPlot(QWidget *parent) : QwtPlot(parent), m_spectro(0), m_panner(0),
 LWPlot::~LWPlot()
 {
     deinitPlot();
+    delete m_colormap;
 }
 
 void LWPlot::initPlot()
@@ -134,11 +138,18 @@ void LWPlot::initPlot()
     axisWidget(QwtPlot::yLeft)->setTitle(title);
     axisWidget(QwtPlot::yLeft)->setFont(newSmallFont);
 
-    m_spectro = new QwtPlotSpectrogram();
+    m_spectro = new LWSpectrogram();
     m_spectro->setData(LWRasterData());   // dummy object
     m_spectro->setDisplayMode(QwtPlotSpectrogram::ImageMode, true);
     m_spectro->setDisplayMode(QwtPlotSpectrogram::ContourMode, false);
     m_spectro->attach(this);
+    // replot when previewed parts are rendered at full resolution
+    connect(m_spectro->refiner(), SIGNAL(refined()), this, SLOT(replot()));
+
+    // Qwt's contour mode is too slow for our images, use our own overlay
+    m_contour = new LWContourItem(m_spectro);
+    m_contour->attach(this);
+    connect(m_contour, SIGNAL(contoursReady()), this, SLOT(replot()));
 
     setCanvasBackground(Qt::white);
 
@@ -194,13 +205,34 @@ void LWPlot::deinitPlot()
     if (m_panner)   { delete m_panner; m_panner = 0; }
     if (m_picker)   { delete m_picker; m_picker = 0; }
     if (m_rescaler) { delete m_rescaler; m_rescaler = 0; }
+    if (m_contour)  { delete m_contour; m_contour = 0; }
     if (m_spectro)  { delete m_spectro; m_spectro = 0; }
 }
 
+void LWPlot::updateColorLut(bool force)
+{
+    if (!m_colormap)
+        return;
+
+    const QwtRasterData &data = m_spectro->data();
+    const LWRasterData *lwdata = dynamic_cast<const LWRasterData *>(&data);
+    QwtDoubleInterval range = data.range();
+    bool log10 = lwdata && lwdata->lwData()->isLog10();
+
+    // only sample the color map again if map, range or log mode changed
+    const LWColorLut *lut = dynamic_cast<const LWColorLut *>(&m_spectro->colorMap());
+    if (!force && lut && lut->range() == range && log10 == m_lut_log10)
+        return;
+    m_spectro->setColorMap(LWColorLut(*m_colormap, range));
+    m_lut_log10 = log10;
+}
+
 void LWPlot::updateRange()
 {
     LWRasterData &data = (LWRasterData &)m_spectro->data();
 
+    updateColorLut();
+
     QwtDoubleInterval range = data.range();
     setAxisScale(QwtPlot::yRight, range.minValue(), range.maxValue());
     axisWidget(QwtPlot::yRight)->setColorMap(data.range(),
@@ -221,15 +253,52 @@ void LWPlot::setData(QwtRasterData* data)
     if (!m_spectro)
         return;
     m_spectro->setData(*data);
+    // replot once the reduced levels for zoomed-out display are built
+    const LWRasterData *lwdata = dynamic_cast<const LWRasterData *>(data);
+    if (lwdata)
+        connect(lwdata->lwData()->pyramid(), SIGNAL(levelsReady()),
+                this, SLOT(replot()), Qt::UniqueConnection);
     updateRange();
     replot();
 }
 
+void LWPlot::setPyramidMode(LWPyramidMode mode)
+{
+    m_spectro->setPyramidMode(mode);
+    replot();
+}
+
+void LWPlot::setPyramidLevel(int level)
+{
+    m_spectro->setPyramidLevel(level);
+    replot();
+}
+
+void LWPlot::setProgressive(bool on)
+{
+    m_spectro->setProgressive(on);
+    replot();
+}
+
+void LWPlot::setContourCount(int count)
+{
+    m_contour->setContourCount(count);
+    replot();
+}
+
+void LWPlot::setContourLevels(const QVector<double> &values)
+{
+    m_contour->setContourLevels(values);
+    replot();
+}
+
 void LWPlot::setColorMap(QwtColorMap &map)
 {
     if (!m_spectro)
         return;
-    m_spectro->setColorMap(map);
+    delete m_colormap;
+    m_colormap = map.copy();
+    updateColorLut(true);
 }
 
 void LWPlot::printPlot()
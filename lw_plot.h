@@ -41,7 +41,9 @@
 #include <qwt_plot_grid.h>
 #include <qwt_scale_widget.h>
 
+#include "lw_contour.h"
 #include "lw_data.h"
+#include "lw_spectrogram.h"
 
 
 class LWZoomer : public QwtPlotZoomer
@@ -72,14 +74,18 @@ class LWPlot : public QwtPlot
   private:
     void initPlot();
     void deinitPlot();
+    void updateColorLut(bool force = false);
 
   protected:
-    QwtPlotSpectrogram *m_spectro;
+    LWSpectrogram *m_spectro;
+    LWContourItem *m_contour;
     QwtPlotPanner *m_panner;
     QwtPlotPicker *m_picker;
     QwtPlotRescaler *m_rescaler;
     QwtPlotGrid *m_grid;
     LWZoomer *m_zoomer;
+    QwtColorMap *m_colormap;  // the map given to setColorMap
+    bool m_lut_log10;         // log mode the current color table was made for
     int m_scale_width;
     int m_scale_height;
 
@@ -97,6 +103,20 @@ class LWPlot : public QwtPlot
     void setGrid(bool val);
     void setColorMap(QwtColorMap &map);
 
+    LWPyramidMode pyramidMode() const { return m_spectro->pyramidMode(); }
+    void setPyramidMode(LWPyramidMode mode);
+    int pyramidLevel() const { return m_spectro->pyramidLevel(); }
+    void setPyramidLevel(int level);
+    /// Show a quick preview of large renders first, see LWSpectrogram.
+    bool isProgressive() const { return m_spectro->isProgressive(); }
+    void setProgressive(bool on);
+
+    /// Contour lines over the image, see LWContourItem.
+    LWContourItem *contourItem() { return m_contour; }
+    int contourCount() const { return m_contour->contourCount(); }
+    void setContourCount(int count);
+    void setContourLevels(const QVector<double> &values);
+
     bool hasGrid() { return m_grid->isVisible(); }
 
   public slots:
@@ -21,85 +21,403 @@
 //
 // *****************************************************************************
 
+#include <algorithm>
 #include <iostream>
+#include <math.h>
 #include <stdio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "lw_controls.h"
+#include "lw_parallel.h"
 
 
-static double *integrate_x(LWData *data)
-{
-    int h = data->height();
-    double *dest = new double[h*data->width()];
-    for (int x = 0; x < data->width(); x++) {
-        for (int y = 0; y < h; y++)
-            dest[h*x+y] = data->value(x, y);
+namespace {
+
+/// Sums the weighted taps of the samples across the line for a band of
+/// positions along it.
+template <class T>
+struct SampleGather {
+    const T *source;
+    const qint32 *index;
+    const float *weight;
+    int count;  // taps per position, a multiple of 4
+    double *profile;
+
+    void operator()(int begin, int end) const {
+        for (int i = begin; i < end; i++) {
+            const qint32 *ix = index + (size_t)i * count;
+            const float *w = weight + (size_t)i * count;
+#ifdef __SSE2__
+            // in double precision like below, since wide lines easily
+            // sum up beyond the 24 bits of a float
+            __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+            for (int j = 0; j < count; j += 4, ix += 4, w += 4) {
+                __m128 wf = _mm_loadu_ps(w);
+                __m128d v0 = _mm_setr_pd((double)source[ix[0]], (double)source[ix[1]]);
+                __m128d v1 = _mm_setr_pd((double)source[ix[2]], (double)source[ix[3]]);
+                acc0 = _mm_add_pd(acc0, _mm_mul_pd(v0, _mm_cvtps_pd(wf)));
+                acc1 = _mm_add_pd(acc1, _mm_mul_pd(v1, _mm_cvtps_pd(_mm_movehl_ps(wf, wf))));
+            }
+            double sums[2];
+            _mm_storeu_pd(sums, _mm_add_pd(acc0, acc1));
+            profile[i] = sums[0] + sums[1];
+#else
+            double sum = 0;
+            for (int j = 0; j < count; j += 4, ix += 4, w += 4)
+                sum += w[0] * (double)source[ix[0]] + w[1] * (double)source[ix[1]] +
+                    w[2] * (double)source[ix[2]] + w[3] * (double)source[ix[3]];
+            profile[i] = sum;
+#endif
+        }
     }
-    return dest;
+};
+
+template <class T>
+void gatherSamples(const T *source, const QVector<qint32> &index,
+                   const QVector<float> &weight, int count,
+                   QVector<double> &profile)
+{
+    SampleGather<T> gather;
+    gather.source = source;
+    gather.index = index.constData();
+    gather.weight = weight.constData();
+    gather.count = count;
+    gather.profile = profile.data();
+    lwParallelFor(profile.size(), gather, qMax(16384 / qMax(count, 1), 1));
 }
 
-static double *integrate_y(LWData *data)
+/// Interpolation kernels, for the distance t from the tap.
+inline double linearKernel(double t)
 {
-    int w = data->width();
-    double *dest = new double[w*data->height()];
-    for (int y = 0; y < data->height(); y++) {
-        for (int x = 0; x < w; x++)
-            dest[w*y+x] = data->value(x, y);
-    }
-    return dest;
+    t = fabs(t);
+    return t < 1 ? 1 - t : 0;
 }
 
-/* Uses the "rotation by area mapping" as implemented by leptonica.com */
+inline double cubicKernel(double t)
+{
+    // Keys' cubic convolution with a = -0.5
+    const double a = -0.5;
+    t = fabs(t);
+    if (t <= 1)
+        return ((a + 2) * t - (a + 3)) * t * t + 1;
+    if (t < 2)
+        return ((a * t - 5 * a) * t + 8 * a) * t - 4 * a;
+    return 0;
+}
 
-static double *straightenLine(LWData *data, int x1, int y1, int x2, int y2,
-                              int lw, int *npixels)
+inline double lanczosKernel(double t)
 {
-    if (x1 == 0 && x2 == data->width() && lw == data->height()) {
-        *npixels = data->width();
-        return integrate_y(data);
-    }
-    if (y1 == 0 && y2 == data->height() && lw == data->width()) {
-        *npixels = data->height();
-        return integrate_x(data);
+    // Lanczos-3
+    if (t == 0)
+        return 1;
+    if (fabs(t) >= 3)
+        return 0;
+    double pt = M_PI * t;
+    return 3 * sin(pt) * sin(pt / 3) / (pt * pt);
+}
+
+/// Most source pixels of a profile (512 MB with their weights).
+const qint64 maxStencilSize = 64 * 1024 * 1024;
+
+/// Taps along each axis of the interpolations.
+int axisTaps(LWInterpolation mode)
+{
+    switch (mode) {
+    case InterpolationBicubic: return 4;
+    case InterpolationLanczos: return 6;
+    default: return 2;
     }
+}
+
+}
+
+
+LWLineProfile::LWLineProfile()
+    : m_lw(0), m_data_width(0), m_data_height(0),
+      m_interpolation(InterpolationArea), m_taps(4), m_refused(false),
+      m_unit_positions(false),
+      m_changed_begin(0), m_changed_end(0)
+{
+}
+
+void LWLineProfile::setInterpolation(LWInterpolation mode)
+{
+    if (mode == m_interpolation)
+        return;
+    m_interpolation = mode;
+    int n = axisTaps(mode);
+    m_taps = n * n;
+    // rebuild the stencil at the next compute()
+    m_index.clear();
+    m_weight.clear();
+    m_vertices.clear();
+    m_refused = false;
+}
 
+/* Uses the "rotation by area mapping" as implemented by leptonica.com */
+
+void LWLineProfile::prepareSegment(int x1, int y1, int x2, int y2, int length,
+                                   qint32 *index, float *weight) const
+{
     double angle = - atan2(y2 - y1, x2 - x1);
-    double len = sqrt(pow(x2 - x1, 2) + pow(y2 - y1, 2));
-    int width = *npixels = (int)(len + 0.5);
-    int height = lw;
-    double *dest = new double[width * height];
-    data_t xpm, ypm, xp, yp, xf, yf;
-    data_t v00, v01, v10, v11;
 
     double sina = 16. * sin(angle);
     double cosa = 16. * cos(angle);
 
-    double xstart = 16. * x1 - lw/2. * sina;
-    double ystart = 16. * y1 - lw/2. * cosa;
-
-    for (int x = 0; x < width; x++) {
-        for (int y = 0; y < height; y++) {
-            xpm = (data_t)(xstart + x * cosa + y * sina);
-            ypm = (data_t)(ystart + y * cosa - x * sina);
-            xp = xpm >> 4;
-            yp = ypm >> 4;
-            xf = xpm & 0xF;
-            yf = ypm & 0xF;
-
-            // area weighting
-            v00 = (16 - xf) * (16 - yf) * (long)data->value(xp, yp);
-            v10 = xf * (16 - yf) * (long)data->value(xp + 1, yp);
-            v01 = (16 - xf) * yf * (long)data->value(xp, yp + 1);
-            v11 = xf * yf * (long)data->value(xp + 1, yp + 1);
-            dest[y * width + x] = (v00 + v01 + v10 + v11 + 128) / 256;
+    double xstart = 16. * x1 - m_lw/2. * sina;
+    double ystart = 16. * y1 - m_lw/2. * cosa;
+
+    if (m_interpolation != InterpolationArea) {
+        prepareInterpolated(xstart, ystart, sina, cosa, length, index, weight);
+        return;
+    }
+
+    // four source pixels per sample, with the area of the sample that
+    // falls on them; pixels outside of the data get no weight
+    for (int x = 0; x < length; x++) {
+        for (int y = 0; y < m_lw; y++, index += 4, weight += 4) {
+            int xpm = (int)floor(xstart + x * cosa + y * sina);
+            int ypm = (int)floor(ystart + y * cosa - x * sina);
+            int xp = xpm >> 4, yp = ypm >> 4;
+            int xf = xpm & 0xF, yf = ypm & 0xF;
+            const int px[4] = {xp, xp + 1, xp, xp + 1};
+            const int py[4] = {yp, yp, yp + 1, yp + 1};
+            const int area[4] = {(16 - xf) * (16 - yf), xf * (16 - yf),
+                                 (16 - xf) * yf, xf * yf};
+            for (int k = 0; k < 4; k++) {
+                if (px[k] >= 0 && px[k] < m_data_width &&
+                    py[k] >= 0 && py[k] < m_data_height) {
+                    index[k] = py[k] * m_data_width + px[k];
+                    weight[k] = area[k] / 256.f;
+                } else {
+                    index[k] = 0;
+                    weight[k] = 0;
+                }
+            }
+        }
+    }
+}
+
+void LWLineProfile::prepareInterpolated(double xstart, double ystart,
+                                        double sina, double cosa, int length,
+                                        qint32 *index, float *weight) const
+{
+    // the samples are at the same positions as above, but interpolated
+    // from n x n taps around them at full precision; taps beyond the edge
+    // repeat the edge pixels, samples outside of the data get no weight
+    const int n = axisTaps(m_interpolation);
+    double (*kernel)(double) = linearKernel;
+    if (m_interpolation == InterpolationBicubic)
+        kernel = cubicKernel;
+    else if (m_interpolation == InterpolationLanczos)
+        kernel = lanczosKernel;
+
+    double wx[6], wy[6];
+    int tx[6], ty[6];
+    for (int x = 0; x < length; x++) {
+        for (int y = 0; y < m_lw; y++, index += m_taps, weight += m_taps) {
+            double u = (xstart + x * cosa + y * sina) / 16.;
+            double v = (ystart + y * cosa - x * sina) / 16.;
+            if (u < -0.5 || u >= m_data_width - 0.5 ||
+                v < -0.5 || v >= m_data_height - 0.5) {
+                for (int k = 0; k < m_taps; k++) {
+                    index[k] = 0;
+                    weight[k] = 0;
+                }
+                continue;
+            }
+            int u0 = (int)floor(u) - (n/2 - 1), v0 = (int)floor(v) - (n/2 - 1);
+            double sx = 0, sy = 0;
+            for (int k = 0; k < n; k++) {
+                wx[k] = kernel(u - (u0 + k));
+                wy[k] = kernel(v - (v0 + k));
+                sx += wx[k];
+                sy += wy[k];
+                tx[k] = qBound(0, u0 + k, m_data_width - 1);
+                ty[k] = qBound(0, v0 + k, m_data_height - 1);
+            }
+            // Lanczos weights do not quite sum up to 1
+            for (int l = 0; l < n; l++) {
+                for (int k = 0; k < n; k++) {
+                    index[l*n + k] = ty[l] * m_data_width + tx[k];
+                    weight[l*n + k] = (float)(wx[k] / sx * wy[l] / sy);
+                }
+            }
+        }
+    }
+}
+
+void LWLineProfile::prepare()
+{
+    // the segments are sampled one after the other, at about one sample
+    // per pixel of their length
+    int nsegments = m_vertices.size() - 1;
+    QVector<int> lengths(nsegments);
+    QVector<double> lens(nsegments);
+    int total = 0;
+    for (int k = 0; k < nsegments; k++) {
+        const QPoint &a = m_vertices[k], &b = m_vertices[k + 1];
+        lens[k] = sqrt(pow(b.x() - a.x(), 2) + pow(b.y() - a.y(), 2));
+        lengths[k] = (int)(lens[k] + 0.5);
+        total += lengths[k];
+    }
+
+    m_unit_positions = false;
+    m_refused = (qint64)total * m_lw * m_taps > maxStencilSize;
+    if (m_refused) {
+        std::cerr << "profile line too long or wide for this sampling"
+                  << std::endl;
+        m_index.clear();
+        m_weight.clear();
+        m_positions.clear();
+        return;
+    }
+    m_index.resize(total * m_lw * m_taps);
+    m_weight.resize(total * m_lw * m_taps);
+    m_positions.resize(total);
+    int start = 0;
+    double arc = 0;
+    for (int k = 0; k < nsegments; k++) {
+        const QPoint &a = m_vertices[k], &b = m_vertices[k + 1];
+        prepareSegment(a.x(), a.y(), b.x(), b.y(), lengths[k],
+                       m_index.data() + (size_t)start * m_lw * m_taps,
+                       m_weight.data() + (size_t)start * m_lw * m_taps);
+        for (int i = 0; i < lengths[k]; i++)
+            m_positions[start + i] = arc + i * lens[k] / lengths[k];
+        start += lengths[k];
+        arc += lens[k];
+    }
+}
+
+void LWLineProfile::setUnitPositions(int count)
+{
+    if (m_unit_positions && m_positions.size() == count)
+        return;
+    m_positions.resize(count);
+    for (int i = 0; i < count; i++)
+        m_positions[i] = i;
+    m_unit_positions = true;
+    // the stencil no longer matches the positions
+    m_index.clear();
+}
+
+const QVector<double> &LWLineProfile::compute(const LWData *data, int x1, int y1,
+                                              int x2, int y2, int lw)
+{
+    QVector<QPoint> vertices(2);
+    vertices[0] = QPoint(x1, y1);
+    vertices[1] = QPoint(x2, y2);
+    return compute(data, vertices, lw);
+}
+
+const QVector<double> &LWLineProfile::compute(const LWData *data,
+                                              const QVector<QPoint> &vertices,
+                                              int lw)
+{
+    // keep the last result to find the changed range, without reallocating
+    qSwap(m_profile, m_last);
+    evaluate(data, vertices, lw);
+
+    if (m_profile.size() != m_last.size()) {
+        m_changed_begin = 0;
+        m_changed_end = m_profile.size();
+        return m_profile;
+    }
+    int begin = 0, end = m_profile.size();
+    while (begin < end && m_profile.at(begin) == m_last.at(begin))
+        begin++;
+    while (end > begin && m_profile.at(end - 1) == m_last.at(end - 1))
+        end--;
+    m_changed_begin = begin;
+    m_changed_end = end;
+    return m_profile;
+}
+
+bool LWLineProfile::evaluateDirect(const LWData *data, int x1, int y1,
+                                   int x2, int y2, int lw, bool raw)
+{
+    // projections of the whole image are summed straight from the data;
+    // their samples are on the pixel centers, so that no interpolation
+    // changes them
+    if (x1 == 0 && x2 == data->width() && lw == data->height()) {
+        m_profile.resize(data->width());
+        data->projectColumns(m_profile.data(), raw);
+        return true;
+    }
+    if (y1 == 0 && y2 == data->height() && lw == data->width()) {
+        m_profile.resize(data->height());
+        data->projectRows(m_profile.data(), raw);
+        return true;
+    }
+    if (raw)
+        return false;
+    // axis-parallel lines of even width cover whole pixels: take the sums
+    // across the line from the summed-area table
+    if (data->hasSummedAreaTable() && !data->isLog10() && lw > 0 && lw % 2 == 0) {
+        if (y1 == y2 && x2 > x1) {
+            m_profile.resize(x2 - x1);
+            for (int i = 0; i < x2 - x1; i++)
+                m_profile[i] = data->rectSum(x1 + i, y1 - lw/2, 1, lw);
+            return true;
+        }
+        if (x1 == x2 && y2 > y1) {
+            m_profile.resize(y2 - y1);
+            for (int i = 0; i < y2 - y1; i++)
+                m_profile[i] = data->rectSum(x1 - lw/2 + 1, y1 + i, lw, 1);
+            return true;
         }
     }
-    return dest;
+    return false;
+}
+
+void LWLineProfile::evaluate(const LWData *data, const QVector<QPoint> &vertices,
+                             int lw)
+{
+    if (vertices.size() < 2) {
+        m_profile.clear();
+        m_positions.clear();
+        return;
+    }
+    // the direct sums are of the same values as the sampling
+    if (vertices.size() == 2 &&
+        evaluateDirect(data, vertices[0].x(), vertices[0].y(),
+                       vertices[1].x(), vertices[1].y(), lw,
+                       m_interpolation != InterpolationArea)) {
+        setUnitPositions(m_profile.size());
+        return;
+    }
+
+    // the samples only depend on the geometry; they are rebuilt after a
+    // direct sum dropped them, but a refused geometry is not retried
+    lw = qMax(lw, 1);
+    if (vertices != m_vertices || lw != m_lw ||
+        data->width() != m_data_width || data->height() != m_data_height ||
+        (m_index.isEmpty() && !m_refused)) {
+        m_vertices = vertices;
+        m_lw = lw;
+        m_data_width = data->width();
+        m_data_height = data->height();
+        prepare();
+    }
+
+    // all segments are gathered in one parallel pass; the interpolations
+    // always work on the raw counts
+    int count = m_taps * m_lw;
+    m_profile.resize(m_index.size() / count);
+    if (!data->currentLayer() || m_profile.isEmpty())
+        m_profile.fill(0);
+    else if (!data->logImage().isEmpty() && m_interpolation == InterpolationArea)
+        gatherSamples(data->logImage().constData(), m_index, m_weight, count,
+                      m_profile);
+    else
+        gatherSamples(data->currentLayer(), m_index, m_weight, count, m_profile);
 }
 
 
 LWProfileWindow::LWProfileWindow(QWidget *parent, LWWidget *widget) :
-    QMainWindow(parent), m_data_x(0), m_data_y(0)
+    QMainWindow(parent), m_decimated(true), m_width(0), m_bins(0), m_type(0)
 {
     m_widget = widget;
     m_plot = new QwtPlot(this);
@@ -114,6 +432,8 @@ LWProfileWindow::LWProfileWindow(QWidget *parent, LWWidget *widget) :
     m_picker->setMousePattern(QwtPicker::MouseSelect1, Qt::MidButton);
     QObject::connect(m_picker, SIGNAL(selected(const QwtDoublePoint &)),
                      this, SLOT(pickerSelected(const QwtDoublePoint &)));
+    QObject::connect(m_zoomer, SIGNAL(zoomed(const QwtDoubleRect &)),
+                     this, SLOT(zoomed(const QwtDoubleRect &)));
     setCentralWidget(m_plot);
     setContentsMargins(5, 5, 5, 5);
     QFont plotfont(font());
@@ -128,34 +448,161 @@ LWProfileWindow::~LWProfileWindow()
 {
 }
 
-void LWProfileWindow::update(LWData *data, double *px, double *py,
-                             int w, int b, int type)
+void LWProfileWindow::update(LWData *data, const QVector<double> &px,
+                             const QVector<double> &py, int w, int b, int type)
 {
-    if (m_data_x) {
-        delete[] m_data_x;
-        m_data_x = 0;
-        delete[] m_data_y;
-        m_data_y = 0;
+    QVector<QPoint> vertices(qMin(px.size(), py.size()));
+    for (int i = 0; i < vertices.size(); i++)
+        vertices[i] = QPoint((int)px[i], (int)py[i]);
+    const QVector<double> &profile = m_profile.compute(data, vertices, w);
+    int nbins = profile.size() / b;
+
+    // for a new frame on the same line, only rebin what has changed
+    bool same = vertices == m_vertices && w == m_width &&
+        b == m_bins && type == m_type && nbins == m_data_y.size();
+    int first = 0, last = nbins;
+    if (same) {
+        first = m_profile.changedBegin() / b;
+        last = qMin((m_profile.changedEnd() + b - 1) / b, nbins);
+    } else {
+        m_vertices = vertices;
+        m_width = w;
+        m_bins = b;
+        m_type = type;
+        // the buffers are only reallocated if the number of bins changes;
+        // bins are placed at the arc length of their first sample
+        m_data_x.resize(nbins);
+        m_data_y.resize(nbins);
+        for (int i = 0; i < nbins; i++)
+            m_data_x[i] = m_profile.positions()[i*b];
     }
-    int len;
-    double *straight = straightenLine(data, px[0], py[0], px[1], py[1], w, &len);
-    int nbins = len / b;
-    m_data_x = new double[nbins];
-    m_data_y = new double[nbins];
-    for (int i = 0; i < nbins; i++) {
-        m_data_x[i] = i*b;
+    for (int i = first; i < last; i++) {
         m_data_y[i] = 0;
-        for (int j = 0; j < w; j++)
-            for (int k = 0; k < b; k++)
-                m_data_y[i] += straight[len*j + (i*b + k)];
+        for (int k = 0; k < b; k++)
+            m_data_y[i] += profile[i*b + k];
+    }
+    // a new curve is shown unzoomed
+    if (!same || first < last)
+        decimate(!same);
+
+    if (!same) {
+        m_plot->setAxisAutoScale(QwtPlot::xBottom);
+        m_plot->setAxisAutoScale(QwtPlot::yLeft);
+        m_zoomer->setZoomBase(true);
+    } else if (first < last) {
+        // keep the user's zoom; unzoomed, follow the data (zooming has
+        // fixed the scales)
+        if (m_zoomer->zoomRectIndex() == 0) {
+            m_plot->setAxisAutoScale(QwtPlot::xBottom);
+            m_plot->setAxisAutoScale(QwtPlot::yLeft);
+            m_zoomer->setZoomBase(true);
+        } else {
+            m_plot->replot();
+        }
     }
-    delete[] straight;
+    emit m_widget->profileUpdate(m_type, nbins, m_data_x.data(), m_data_y.data());
+}
+
+void LWProfileWindow::showCurve(const QVector<double> &x,
+                                const QVector<double> &y, int type)
+{
+    int n = qMin(x.size(), y.size());
+    bool same = m_vertices.isEmpty() && type == m_type &&
+        n == m_data_y.size();
+    m_vertices.clear();
     m_type = type;
-    m_curve->setData(QwtCPointerData(m_data_x, m_data_y, nbins));
-    m_plot->setAxisAutoScale(QwtPlot::xBottom);
-    m_plot->setAxisAutoScale(QwtPlot::yLeft);
-    m_zoomer->setZoomBase(true);
-    emit m_widget->profileUpdate(m_type, nbins, m_data_x, m_data_y);
+    m_data_x = x;
+    m_data_x.resize(n);
+    m_data_y = y;
+    m_data_y.resize(n);
+    decimate(!same);
+
+    if (!same) {
+        m_plot->setAxisAutoScale(QwtPlot::xBottom);
+        m_plot->setAxisAutoScale(QwtPlot::yLeft);
+        m_zoomer->setZoomBase(true);
+    } else if (m_zoomer->zoomRectIndex() == 0) {
+        m_plot->setAxisAutoScale(QwtPlot::xBottom);
+        m_plot->setAxisAutoScale(QwtPlot::yLeft);
+        m_zoomer->setZoomBase(true);
+    } else {
+        m_plot->replot();
+    }
+    emit m_widget->profileUpdate(m_type, n, m_data_x.data(), m_data_y.data());
+}
+
+void LWProfileWindow::setInterpolation(LWInterpolation mode)
+{
+    m_profile.setInterpolation(mode);
+}
+
+void LWProfileWindow::setDecimated(bool on)
+{
+    m_decimated = on;
+    decimate();
+    m_plot->replot();
+}
+
+void LWProfileWindow::decimate(bool full)
+{
+    const int n = m_data_y.size();
+    const int columns = qMax(m_plot->canvas()->width(), 1);
+    const double *x = m_data_x.constData(), *y = m_data_y.constData();
+    // short profiles are cheap to draw as they are
+    if (!m_decimated || n <= 4 * columns) {
+        m_curve->setData(QwtCPointerData(x, y, n));
+        return;
+    }
+
+    // the visible range, plus one bin on either side for the lines that
+    // leave the canvas
+    double lo = x[0], hi = x[n - 1];
+    if (!full && m_zoomer->zoomRectIndex() > 0) {
+        lo = m_zoomer->zoomRect().left();
+        hi = m_zoomer->zoomRect().right();
+    }
+    int begin = qMax(int(std::lower_bound(x, x + n, lo) - x) - 1, 0);
+    int end = qMin(int(std::upper_bound(x, x + n, hi) - x) + 1, n);
+    double scale = columns / qMax(hi - lo, 1e-12);
+
+    // at most 4 points for each column and the two extra bins
+    m_env_x.resize(4 * (columns + 3));
+    m_env_y.resize(4 * (columns + 3));
+    int count = 0;
+    int i = begin;
+    while (i < end) {
+        int column = (int)floor((x[i] - lo) * scale);
+        int first = i, imin = i, imax = i;
+        while (++i < end && (int)floor((x[i] - lo) * scale) == column) {
+            if (y[i] < y[imin])
+                imin = i;
+            if (y[i] > y[imax])
+                imax = i;
+        }
+        // in the order of the bins, without repeating one
+        const int pick[4] = {first, qMin(imin, imax), qMax(imin, imax), i - 1};
+        for (int k = 0; k < 4; ++k) {
+            if (k > 0 && pick[k] == pick[k - 1])
+                continue;
+            m_env_x[count] = x[pick[k]];
+            m_env_y[count] = y[pick[k]];
+            count++;
+        }
+    }
+    m_curve->setData(QwtCPointerData(m_env_x.constData(), m_env_y.constData(),
+                                     count));
+}
+
+void LWProfileWindow::resizeEvent(QResizeEvent *event)
+{
+    QMainWindow::resizeEvent(event);
+    decimate();
+}
+
+void LWProfileWindow::zoomed(const QwtDoubleRect &)
+{
+    decimate();
+    m_plot->replot();
 }
 
 void LWProfileWindow::pickerSelected(const QwtDoublePoint &point)
@@ -27,12 +27,88 @@
 #include "lw_common.h"
 
 #include <QMainWindow>
+#include <QPoint>
+#include <QVector>
 
 class LWWidget;
 
 #include "lw_widget.h"
 
 
+/// Profile along a straight line or a polyline, summed across the line
+/// width.
+///
+/// Each segment is sampled by "rotation by area mapping" with 16x16
+/// subpixels, and the segments are concatenated by arc length.  Instead,
+/// the samples can be interpolated bilinearly, bicubically or with a
+/// Lanczos-3 kernel from the raw counts, at full precision.  The source
+/// pixels and weights of all samples are computed once per line geometry.
+/// Each update then only gathers the pixels, in parallel along the line
+/// and with SSE2 where available.  Whole-image X/Y profiles and, with
+/// LWData::setSummedAreaTable, axis-parallel boxes are summed directly.
+class LWLineProfile
+{
+  private:
+    QVector<QPoint> m_vertices;
+    int m_lw;
+    int m_data_width, m_data_height;
+    LWInterpolation m_interpolation;
+    int m_taps;               // source pixels per sample
+    QVector<qint32> m_index;  // m_taps source pixels per sample,
+    QVector<float> m_weight;  // with their weights
+    bool m_refused;           // the stencil would be too large
+    QVector<double> m_positions;
+    bool m_unit_positions;    // positions are 0, 1, ... without a stencil
+    QVector<double> m_profile, m_last;
+    int m_changed_begin, m_changed_end;
+
+    void prepareSegment(int x1, int y1, int x2, int y2, int length,
+                        qint32 *index, float *weight) const;
+    void prepareInterpolated(double xstart, double ystart, double sina,
+                             double cosa, int length, qint32 *index,
+                             float *weight) const;
+    void prepare();
+    void setUnitPositions(int count);
+    bool evaluateDirect(const LWData *data, int x1, int y1, int x2, int y2,
+                        int lw, bool raw);
+    void evaluate(const LWData *data, const QVector<QPoint> &vertices, int lw);
+
+  public:
+    LWLineProfile();
+
+    /// Sampling of the line (default InterpolationArea).  The area mapping
+    /// samples the displayed values, the others the raw counts.
+    LWInterpolation interpolation() const { return m_interpolation; }
+    void setInterpolation(LWInterpolation mode);
+
+    /// Profile of the current layer from (x1, y1) to (x2, y2) with
+    /// width "lw", one value per pixel along the line.  The result is
+    /// valid until the next call, and empty if the line needs more than
+    /// 64M source pixels.
+    const QVector<double> &compute(const LWData *data, int x1, int y1,
+                                   int x2, int y2, int lw);
+    /// Same along the polyline through "vertices".  At bends, the samples
+    /// of the adjoining segments overlap on the inside of the bend.
+    const QVector<double> &compute(const LWData *data,
+                                   const QVector<QPoint> &vertices, int lw);
+    /// Arc length from the first vertex of each value of the profile.
+    const QVector<double> &positions() const { return m_positions; }
+    /// Range of profile positions that differ from the previous compute(),
+    /// all of them if the length changed.
+    int changedBegin() const { return m_changed_begin; }
+    int changedEnd() const { return m_changed_end; }
+    /// The result of the last compute().
+    const QVector<double> &profile() const { return m_profile; }
+};
+
+
+/// Window with the plot of a line profile.
+///
+/// Profiles with many more bins than the plot has pixel columns are drawn
+/// decimated: per pixel column, only the first, minimum, maximum and last
+/// bin are passed to the curve, which looks the same at a fraction of the
+/// drawing cost.  The envelope is recomputed on zoom, resize and new data;
+/// profileUpdate() always carries all bins.
 class LWProfileWindow : public QMainWindow
 {
     Q_OBJECT
@@ -43,17 +119,46 @@ class LWProfileWindow : public QMainWindow
     QwtPlotCurve *m_curve;
     QwtPlotZoomer *m_zoomer;
     QwtPlotPicker *m_picker;
-    double *m_data_x, *m_data_y;
+    LWLineProfile m_profile;
+    QVector<double> m_data_x, m_data_y;
+    bool m_decimated;
+    QVector<double> m_env_x, m_env_y;  // decimated curve
+    // geometry of the current curve
+    QVector<QPoint> m_vertices;
+    int m_width, m_bins;
     int m_type;
 
+    /// Recompute the envelope for the zoomed range, or all of the curve.
+    void decimate(bool full = false);
+
+  protected:
+    virtual void resizeEvent(QResizeEvent *event);
+
   protected slots:
     void pickerSelected(const QwtDoublePoint &point);
+    void zoomed(const QwtDoubleRect &rect);
 
   public:
     LWProfileWindow(QWidget *parent, LWWidget *widget);
     virtual ~LWProfileWindow();
 
-    void update(LWData *data, double *px, double *py, int width, int bins, int type);
+    /// Sampling of the profile line, see LWLineProfile.
+    LWInterpolation interpolation() const { return m_profile.interpolation(); }
+    void setInterpolation(LWInterpolation mode);
+
+    /// Draw long profiles as min/max envelope (default on).
+    bool isDecimated() const { return m_decimated; }
+    void setDecimated(bool on);
+
+    /// Show the profile along the line through the points (px[i], py[i]),
+    /// over the arc length.  For new data on an unchanged line, only the
+    /// changed bins are recomputed and the zoom is kept.
+    void update(LWData *data, const QVector<double> &px,
+                const QVector<double> &py, int width, int bins, int type);
+    /// Show an already computed curve, e.g. from an LWRadialIntegrator.
+    /// The zoom is kept while the type and number of points stay the same.
+    void showCurve(const QVector<double> &x, const QVector<double> &y,
+                   int type);
 };
 
 #endif
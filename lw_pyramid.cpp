@@ -0,0 +1,135 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#include <string.h>
+
+#include <QMutexLocker>
+#include <QtConcurrentRun>
+
+#include "lw_pyramid.h"
+
+// stop reducing when the level gets this small
+#define MIN_LEVEL_SIZE 16
+
+
+/// Reduce 2x2 blocks of "src" (w x h) into "dest"; blocks at the right and
+/// bottom edge may be incomplete.
+template <class T, class R>
+static void reduce(const T *src, int w, int h, R *dest, bool mean)
+{
+    int dw = (w + 1) / 2;
+    int dh = (h + 1) / 2;
+    for (int y = 0; y < dh; ++y) {
+        const T *row0 = src + (size_t)(2 * y) * w;
+        const T *row1 = (2 * y + 1 < h) ? row0 + w : row0;
+        for (int x = 0; x < dw; ++x) {
+            int x1 = (2 * x + 1 < w) ? 2 * x + 1 : 2 * x;
+            if (mean) {
+                dest[(size_t)y * dw + x] = (R)(((double)row0[2*x] + row0[x1] +
+                                                 row1[2*x] + row1[x1]) / 4.);
+            } else {
+                T m = qMax(qMax(row0[2*x], row0[x1]), qMax(row1[2*x], row1[x1]));
+                dest[(size_t)y * dw + x] = (R)m;
+            }
+        }
+    }
+}
+
+
+LWPyramid::LWPyramid() : QObject(), m_generation(0), m_mode(PyramidOff)
+{
+}
+
+LWPyramid::~LWPyramid()
+{
+    m_build.waitForFinished();
+}
+
+bool LWPyramid::request(const LWData *data, LWPyramidMode mode,
+                        QList<LWPyramidLevel> &levels)
+{
+    if (mode == PyramidOff)
+        return false;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_generation == data->generation() && m_mode == mode) {
+            levels = m_levels;
+            return true;
+        }
+    }
+    // a finished build for older data triggers another request
+    if (m_build.isRunning())
+        return false;
+
+    Job *job = new Job;
+    job->width = data->width();
+    job->height = data->height();
+    job->generation = data->generation();
+    job->mode = mode;
+    // snapshot, the data may change while the levels are built
+    job->layer.resize(job->width * job->height);
+    memcpy(job->layer.data(), data->currentLayer(),
+           sizeof(data_t) * job->layer.size());
+    m_build = QtConcurrent::run(this, &LWPyramid::build, job);
+    return false;
+}
+
+void LWPyramid::build(Job *job)
+{
+    QList<LWPyramidLevel> levels;
+    bool mean = (job->mode == PyramidMean);
+    int w = job->width;
+    int h = job->height;
+
+    while (w > MIN_LEVEL_SIZE || h > MIN_LEVEL_SIZE) {
+        LWPyramidLevel level;
+        level.width = (w + 1) / 2;
+        level.height = (h + 1) / 2;
+        size_t n = (size_t)level.width * level.height;
+        if (mean) {
+            level.mean.resize(n);
+            if (levels.isEmpty())
+                reduce(job->layer.constData(), w, h, level.mean.data(), true);
+            else
+                reduce(levels.last().mean.constData(), w, h, level.mean.data(), true);
+        } else {
+            level.max.resize(n);
+            if (levels.isEmpty())
+                reduce(job->layer.constData(), w, h, level.max.data(), false);
+            else
+                reduce(levels.last().max.constData(), w, h, level.max.data(), false);
+        }
+        levels.append(level);
+        w = level.width;
+        h = level.height;
+    }
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_levels = levels;
+        m_generation = job->generation;
+        m_mode = job->mode;
+    }
+    delete job;
+    emit levelsReady();
+}
@@ -0,0 +1,88 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#ifndef LW_PYRAMID_H
+#define LW_PYRAMID_H
+
+#include <QFuture>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QVector>
+
+#include "lw_common.h"
+#include "lw_data.h"
+
+
+/// One reduced copy of a layer: level k has 2^k x 2^k source pixels per
+/// pixel.  Depending on the mode, the maximum (counts) or the mean of the
+/// source pixels is stored.
+struct LWPyramidLevel {
+    int width;
+    int height;
+    QVector<data_t> max;
+    QVector<float> mean;
+};
+
+
+/// Mip pyramid of the current layer of an LWData, used to display large
+/// images zoomed out without aliasing away isolated hot pixels.
+///
+/// The levels are built in the background from a snapshot of the layer,
+/// on the first request for a data generation; levelsReady() is emitted
+/// when they are available.
+class LWPyramid : public QObject
+{
+    Q_OBJECT
+
+  private:
+    struct Job {
+        QVector<data_t> layer;
+        int width, height;
+        int generation;
+        LWPyramidMode mode;
+    };
+
+    mutable QMutex m_mutex;
+    QList<LWPyramidLevel> m_levels;  // levels 1, 2, ...
+    int m_generation;
+    LWPyramidMode m_mode;
+    QFuture<void> m_build;
+
+    void build(Job *job);
+
+  public:
+    LWPyramid();
+    /// Waits for a running build to finish.
+    virtual ~LWPyramid();
+
+    /// Get the levels for the current state of data, or start building them
+    /// and return false if they are not available yet.
+    bool request(const LWData *data, LWPyramidMode mode,
+                 QList<LWPyramidLevel> &levels);
+
+  signals:
+    void levelsReady();
+};
+
+#endif
@@ -0,0 +1,624 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#include <iostream>
+#include <math.h>
+#include <string.h>
+
+#include <QHeaderView>
+#include <QPainter>
+#include <QPushButton>
+#include <QtAlgorithms>
+#include <QThread>
+#include <QVBoxLayout>
+
+#include "lw_parallel.h"
+#include "lw_roi.h"
+
+
+namespace {
+
+/// Running statistics of one ROI over a band of rows.
+struct Partial {
+    int pixels;
+    double sum, min, max, sx, sy;
+};
+
+/// Accumulates the spans of a band of rows per ROI; each band has its own
+/// partials, which are merged afterwards.
+template <class Span>
+struct SpanBands {
+    const data_t *source;
+    int width, height, nbands, nrois;
+    const Span *spans;
+    const int *rowStart;
+    Partial *partials;  // nbands * nrois
+
+    void operator()(int begin, int end) const {
+        for (int b = begin; b < end; ++b) {
+            Partial *acc = partials + (size_t)b * nrois;
+            int y0 = (int)((qint64)height * b / nbands);
+            int y1 = (int)((qint64)height * (b + 1) / nbands);
+            for (int y = y0; y < y1; ++y) {
+                const data_t *row = source + (size_t)y * width;
+                for (int s = rowStart[y]; s < rowStart[y + 1]; ++s) {
+                    const Span &span = spans[s];
+                    Partial &p = acc[span.roi];
+                    double sum = 0, sx = 0, min = p.min, max = p.max;
+                    for (int x = span.x0; x < span.x1; ++x) {
+                        double v = row[x];
+                        sum += v;
+                        sx += v * x;
+                        if (v < min)
+                            min = v;
+                        if (v > max)
+                            max = v;
+                    }
+                    p.pixels += span.x1 - span.x0;
+                    p.sum += sum;
+                    p.sx += sx;
+                    p.sy += sum * y;
+                    p.min = min;
+                    p.max = max;
+                }
+            }
+        }
+    }
+};
+
+/// Histograms the spans of a band of rows per ROI, between the minimum
+/// and maximum found by SpanBands.
+template <class Span>
+struct SpanHistograms {
+    const data_t *source;
+    int width, height, nbands, nrois, nbins;
+    const Span *spans;
+    const int *rowStart;
+    const double *lower, *scale;  // per ROI
+    int *counts;                  // nbands * nrois * nbins
+
+    void operator()(int begin, int end) const {
+        for (int b = begin; b < end; ++b) {
+            int *bandCounts = counts + (size_t)b * nrois * nbins;
+            int y0 = (int)((qint64)height * b / nbands);
+            int y1 = (int)((qint64)height * (b + 1) / nbands);
+            for (int y = y0; y < y1; ++y) {
+                const data_t *row = source + (size_t)y * width;
+                for (int s = rowStart[y]; s < rowStart[y + 1]; ++s) {
+                    const Span &span = spans[s];
+                    int *hist = bandCounts + (size_t)span.roi * nbins;
+                    double lo = lower[span.roi], sc = scale[span.roi];
+                    for (int x = span.x0; x < span.x1; ++x)
+                        hist[qMin((int)((row[x] - lo) * sc), nbins - 1)]++;
+                }
+            }
+        }
+    }
+};
+
+/// Pixel spans [x0, x1) of a polygon in row y: pixels whose centers are
+/// inside by the even-odd rule.
+void polygonRow(const QPolygonF &polygon, int y, QVector<double> &xs)
+{
+    double yc = y + 0.5;
+    xs.clear();
+    for (int i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+        const QPointF &a = polygon[i], &b = polygon[j];
+        if ((a.y() <= yc) != (b.y() <= yc))
+            xs.append(a.x() + (yc - a.y()) * (b.x() - a.x()) / (b.y() - a.y()));
+    }
+    qSort(xs);
+}
+
+const char *s_type_names[] = {"rectangle", "line", "polygon"};
+
+}
+
+
+LWRoiManager::LWRoiManager(QObject *parent)
+    : QObject(parent),
+      m_next_id(1),
+      m_span_width(-1),
+      m_span_height(-1),
+      m_histogram_bins(64),
+      m_generation(-1)
+{
+}
+
+LWRoiManager::~LWRoiManager()
+{
+    clear();
+}
+
+int LWRoiManager::indexOf(int id) const
+{
+    for (int i = 0; i < m_rois.size(); ++i)
+        if (m_rois[i].id == id)
+            return i;
+    return -1;
+}
+
+int LWRoiManager::add(const Roi &roi)
+{
+    m_rois.append(roi);
+    Roi &added = m_rois.last();
+    added.id = m_next_id++;
+    if (added.name.isEmpty())
+        added.name = QString("ROI %1").arg(added.id);
+    memset(&added.result, 0, sizeof(LWRoiResult));
+    // spans and results are rebuilt at the next update
+    m_span_width = m_span_height = -1;
+    m_generation = -1;
+    emit roisChanged();
+    return added.id;
+}
+
+int LWRoiManager::addRect(int x, int y, int w, int h, const QString &name)
+{
+    if (w <= 0 || h <= 0) {
+        std::cerr << "empty ROI rectangle" << std::endl;
+        return -1;
+    }
+    Roi roi;
+    roi.name = name;
+    roi.type = RoiRect;
+    roi.x1 = x;
+    roi.y1 = y;
+    roi.x2 = x + w;
+    roi.y2 = y + h;
+    roi.width = 0;
+    roi.profile = NULL;
+    return add(roi);
+}
+
+int LWRoiManager::addLine(int x1, int y1, int x2, int y2, int width,
+                          const QString &name)
+{
+    Roi roi;
+    roi.name = name;
+    roi.type = RoiLine;
+    roi.x1 = x1;
+    roi.y1 = y1;
+    roi.x2 = x2;
+    roi.y2 = y2;
+    roi.width = qMax(width, 1);
+    roi.profile = new LWLineProfile();
+    return add(roi);
+}
+
+int LWRoiManager::addPolygon(const QPolygonF &points, const QString &name)
+{
+    if (points.size() < 3) {
+        std::cerr << "a ROI polygon needs at least 3 points" << std::endl;
+        return -1;
+    }
+    QRectF bounds = points.boundingRect();
+    Roi roi;
+    roi.name = name;
+    roi.type = RoiPolygon;
+    roi.x1 = (int)floor(bounds.left());
+    roi.y1 = (int)floor(bounds.top());
+    roi.x2 = (int)ceil(bounds.right());
+    roi.y2 = (int)ceil(bounds.bottom());
+    roi.width = 0;
+    roi.polygon = points;
+    roi.profile = NULL;
+    return add(roi);
+}
+
+bool LWRoiManager::remove(int id)
+{
+    int i = indexOf(id);
+    if (i < 0) {
+        std::cerr << "no ROI with id " << id << std::endl;
+        return false;
+    }
+    delete m_rois[i].profile;
+    m_rois.removeAt(i);
+    m_span_width = m_span_height = -1;
+    m_generation = -1;
+    emit roisChanged();
+    return true;
+}
+
+void LWRoiManager::clear()
+{
+    if (m_rois.isEmpty())
+        return;
+    for (int i = 0; i < m_rois.size(); ++i)
+        delete m_rois[i].profile;
+    m_rois.clear();
+    m_span_width = m_span_height = -1;
+    m_generation = -1;
+    emit roisChanged();
+}
+
+QList<int> LWRoiManager::ids() const
+{
+    QList<int> result;
+    for (int i = 0; i < m_rois.size(); ++i)
+        result.append(m_rois[i].id);
+    return result;
+}
+
+LWRoiType LWRoiManager::type(int id) const
+{
+    int i = indexOf(id);
+    return i < 0 ? RoiRect : m_rois[i].type;
+}
+
+QString LWRoiManager::name(int id) const
+{
+    int i = indexOf(id);
+    return i < 0 ? QString() : m_rois[i].name;
+}
+
+QList<int> LWRoiManager::geometry(int id) const
+{
+    QList<int> result;
+    int i = indexOf(id);
+    if (i >= 0) {
+        const Roi &roi = m_rois[i];
+        result << roi.x1 << roi.y1 << roi.x2 << roi.y2;
+    }
+    return result;
+}
+
+QPolygonF LWRoiManager::polygon(int id) const
+{
+    int i = indexOf(id);
+    if (i < 0)
+        return QPolygonF();
+    const Roi &roi = m_rois[i];
+    if (roi.type == RoiPolygon)
+        return roi.polygon;
+    QPolygonF outline;
+    outline << QPointF(roi.x1, roi.y1) << QPointF(roi.x2, roi.y2);
+    if (roi.type == RoiRect) {
+        outline.insert(1, QPointF(roi.x2, roi.y1));
+        outline << QPointF(roi.x1, roi.y2);
+    }
+    return outline;
+}
+
+void LWRoiManager::setHistogramBins(int bins)
+{
+    m_histogram_bins = qMax(bins, 0);
+    m_generation = -1;
+}
+
+QList<int> LWRoiManager::histogram(int id) const
+{
+    int i = indexOf(id);
+    if (i < 0)
+        return QList<int>();
+    return m_rois[i].histogram.toList();
+}
+
+LWRoiResult LWRoiManager::result(int id) const
+{
+    int i = indexOf(id);
+    if (i < 0) {
+        LWRoiResult empty;
+        memset(&empty, 0, sizeof(LWRoiResult));
+        return empty;
+    }
+    return m_rois[i].result;
+}
+
+QVector<double> LWRoiManager::profile(int id) const
+{
+    int i = indexOf(id);
+    if (i < 0 || !m_rois[i].profile)
+        return QVector<double>();
+    return m_rois[i].profile->profile();
+}
+
+void LWRoiManager::buildSpans(int width, int height)
+{
+    m_span_width = width;
+    m_span_height = height;
+
+    // spans of each row are collected first, then placed row by row
+    QVector<QVector<Span> > rows(height);
+    QVector<double> xs;
+    for (int i = 0; i < m_rois.size(); ++i) {
+        const Roi &roi = m_rois[i];
+        if (roi.type == RoiLine || roi.x2 <= 0 || roi.x1 >= width)
+            continue;
+        for (int y = qMax(roi.y1, 0); y < qMin(roi.y2, height); ++y) {
+            Span span;
+            span.roi = i;
+            if (roi.type == RoiRect) {
+                span.x0 = qMax(roi.x1, 0);
+                span.x1 = qMin(roi.x2, width);
+                rows[y].append(span);
+                continue;
+            }
+            polygonRow(roi.polygon, y, xs);
+            for (int k = 0; k + 1 < xs.size(); k += 2) {
+                span.x0 = qMax((int)ceil(xs[k] - 0.5), 0);
+                span.x1 = qMin((int)ceil(xs[k + 1] - 0.5), width);
+                if (span.x0 < span.x1)
+                    rows[y].append(span);
+            }
+        }
+    }
+
+    m_row_start.resize(height + 1);
+    m_row_start[0] = 0;
+    for (int y = 0; y < height; ++y)
+        m_row_start[y + 1] = m_row_start[y] + rows[y].size();
+    m_spans.resize(m_row_start[height]);
+    for (int y = 0; y < height; ++y)
+        for (int k = 0; k < rows[y].size(); ++k)
+            m_spans[m_row_start[y] + k] = rows[y][k];
+}
+
+void LWRoiManager::evaluateAreas(const LWData *data)
+{
+    if (data->width() != m_span_width || data->height() != m_span_height)
+        buildSpans(data->width(), data->height());
+
+    // nothing is kept from the last frame, also if no ROI is within this
+    // one or the histograms are switched off
+    for (int i = 0; i < m_rois.size(); ++i) {
+        if (m_rois[i].type == RoiLine)
+            continue;
+        LWRoiResult &result = m_rois[i].result;
+        result.pixels = 0;
+        result.sum = result.mean = result.min = result.max = 0;
+        result.cx = result.cy = 0;
+        if (m_histogram_bins == 0)
+            m_rois[i].histogram.clear();
+        else
+            m_rois[i].histogram.fill(0, m_histogram_bins);
+    }
+    if (m_spans.isEmpty() || !data->currentLayer())
+        return;
+
+    int nrois = m_rois.size();
+    int nbands = qMin(qMax(QThread::idealThreadCount(), 1), m_span_height);
+    QVector<Partial> partials(nbands * nrois);
+    for (int k = 0; k < partials.size(); ++k) {
+        Partial &p = partials[k];
+        p.pixels = 0;
+        p.sum = p.sx = p.sy = 0;
+        p.min = HUGE_VAL;
+        p.max = -HUGE_VAL;
+    }
+
+    SpanBands<Span> bands;
+    bands.source = data->currentLayer();
+    bands.width = m_span_width;
+    bands.height = m_span_height;
+    bands.nbands = nbands;
+    bands.nrois = nrois;
+    bands.spans = m_spans.constData();
+    bands.rowStart = m_row_start.constData();
+    bands.partials = partials.data();
+    lwParallelFor(nbands, bands, 1);
+
+    QVector<double> lower(nrois, 0), scale(nrois, 0);
+    for (int i = 0; i < nrois; ++i) {
+        if (m_rois[i].type == RoiLine)
+            continue;
+        Partial total = partials[i];
+        for (int b = 1; b < nbands; ++b) {
+            const Partial &p = partials[b * nrois + i];
+            total.pixels += p.pixels;
+            total.sum += p.sum;
+            total.sx += p.sx;
+            total.sy += p.sy;
+            total.min = qMin(total.min, p.min);
+            total.max = qMax(total.max, p.max);
+        }
+        LWRoiResult &result = m_rois[i].result;
+        result.pixels = total.pixels;
+        result.sum = total.sum;
+        result.mean = total.pixels ? total.sum / total.pixels : 0;
+        result.min = total.pixels ? total.min : 0;
+        result.max = total.pixels ? total.max : 0;
+        // centroid in pixel centers
+        result.cx = total.sum ? total.sx / total.sum + 0.5 : 0;
+        result.cy = total.sum ? total.sy / total.sum + 0.5 : 0;
+
+        lower[i] = result.min;
+        scale[i] = result.max > result.min ?
+            m_histogram_bins / (result.max - result.min) : 0;
+    }
+
+    if (m_histogram_bins == 0)
+        return;
+    QVector<int> counts(nbands * nrois * m_histogram_bins, 0);
+    SpanHistograms<Span> histograms;
+    histograms.source = data->currentLayer();
+    histograms.width = m_span_width;
+    histograms.height = m_span_height;
+    histograms.nbands = nbands;
+    histograms.nrois = nrois;
+    histograms.nbins = m_histogram_bins;
+    histograms.spans = m_spans.constData();
+    histograms.rowStart = m_row_start.constData();
+    histograms.lower = lower.constData();
+    histograms.scale = scale.constData();
+    histograms.counts = counts.data();
+    lwParallelFor(nbands, histograms, 1);
+
+    for (int i = 0; i < nrois; ++i) {
+        QVector<int> &hist = m_rois[i].histogram;
+        if (m_rois[i].type == RoiLine) {
+            hist.clear();
+            continue;
+        }
+        hist.fill(0, m_histogram_bins);
+        for (int b = 0; b < nbands; ++b) {
+            const int *band = counts.constData() +
+                ((size_t)b * nrois + i) * m_histogram_bins;
+            for (int k = 0; k < m_histogram_bins; ++k)
+                hist[k] += band[k];
+        }
+    }
+}
+
+void LWRoiManager::evaluateLine(const LWData *data, Roi &roi)
+{
+    const QVector<double> &profile =
+        roi.profile->compute(data, roi.x1, roi.y1, roi.x2, roi.y2, roi.width);
+    LWRoiResult &result = roi.result;
+    result.pixels = profile.size();
+    result.sum = result.min = result.max = 0;
+    double moment = 0;
+    for (int i = 0; i < profile.size(); ++i) {
+        result.sum += profile[i];
+        moment += profile[i] * i;
+        if (i == 0 || profile[i] < result.min)
+            result.min = profile[i];
+        if (i == 0 || profile[i] > result.max)
+            result.max = profile[i];
+    }
+    result.mean = profile.isEmpty() ? 0 : result.sum / profile.size();
+    double t = (result.sum && profile.size() > 1) ?
+        moment / result.sum / profile.size() : 0;
+    result.cx = roi.x1 + t * (roi.x2 - roi.x1);
+    result.cy = roi.y1 + t * (roi.y2 - roi.y1);
+}
+
+void LWRoiManager::update(const LWData *data)
+{
+    // results are kept until the data or the ROIs change
+    if (!data || m_rois.isEmpty() || data->generation() == m_generation)
+        return;
+    m_generation = data->generation();
+    evaluateAreas(data);
+    for (int i = 0; i < m_rois.size(); ++i)
+        if (m_rois[i].type == RoiLine)
+            evaluateLine(data, m_rois[i]);
+    emit resultsUpdated();
+}
+
+
+LWRoiItem::LWRoiItem(const LWRoiManager *manager)
+    : QwtPlotItem(QwtText("ROIs")),
+      m_manager(manager),
+      m_pen(Qt::magenta)
+{
+    setZ(100);
+}
+
+int LWRoiItem::rtti() const
+{
+    return QwtPlotItem::Rtti_PlotUserItem + 2;
+}
+
+void LWRoiItem::setPen(const QPen &pen)
+{
+    m_pen = pen;
+    itemChanged();
+}
+
+void LWRoiItem::draw(QPainter *painter, const QwtScaleMap &xMap,
+                     const QwtScaleMap &yMap, const QRect &) const
+{
+    painter->save();
+    painter->setPen(m_pen);
+    QList<int> ids = m_manager->ids();
+    for (int k = 0; k < ids.size(); ++k) {
+        QPolygonF outline = m_manager->polygon(ids[k]);
+        for (int i = 0; i < outline.size(); ++i)
+            outline[i] = QPointF(xMap.xTransform(outline[i].x()),
+                                 yMap.xTransform(outline[i].y()));
+        if (m_manager->type(ids[k]) != RoiLine)
+            outline << outline.first();
+        painter->drawPolyline(outline);
+        painter->drawText((int)outline[0].x() + 3, (int)outline[0].y() - 3,
+                          m_manager->name(ids[k]));
+    }
+    painter->restore();
+}
+
+
+LWRoiWindow::LWRoiWindow(QWidget *parent, LWRoiManager *manager)
+    : QMainWindow(parent), m_manager(manager)
+{
+    QWidget *central = new QWidget(this);
+    QVBoxLayout *layout = new QVBoxLayout(central);
+    m_table = new QTableWidget(0, 9, central);
+    m_table->setHorizontalHeaderLabels(
+        QStringList() << "name" << "type" << "pixels" << "sum" << "mean"
+        << "min" << "max" << "centroid x" << "centroid y");
+    m_table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    m_table->setSelectionBehavior(QAbstractItemView::SelectRows);
+    m_table->verticalHeader()->hide();
+    layout->addWidget(m_table);
+    QPushButton *removeButton = new QPushButton("remove ROI", central);
+    layout->addWidget(removeButton);
+    setCentralWidget(central);
+    setWindowTitle("Regions of interest");
+    resize(700, 200);
+
+    QObject::connect(removeButton, SIGNAL(released()),
+                     this, SLOT(removeSelected()));
+    QObject::connect(m_manager, SIGNAL(roisChanged()), this, SLOT(refresh()));
+    QObject::connect(m_manager, SIGNAL(resultsUpdated()), this, SLOT(refresh()));
+    refresh();
+}
+
+LWRoiWindow::~LWRoiWindow()
+{
+}
+
+void LWRoiWindow::refresh()
+{
+    QList<int> ids = m_manager->ids();
+    m_table->setRowCount(ids.size());
+    for (int row = 0; row < ids.size(); ++row) {
+        LWRoiResult result = m_manager->result(ids[row]);
+        QStringList cells;
+        cells << m_manager->name(ids[row])
+              << s_type_names[m_manager->type(ids[row])]
+              << QString::number(result.pixels)
+              << QString::number(result.sum, 'g', 8)
+              << QString::number(result.mean, 'g', 6)
+              << QString::number(result.min, 'g', 6)
+              << QString::number(result.max, 'g', 6)
+              << QString::number(result.cx, 'f', 1)
+              << QString::number(result.cy, 'f', 1);
+        for (int col = 0; col < cells.size(); ++col) {
+            QTableWidgetItem *item = m_table->item(row, col);
+            if (!item) {
+                item = new QTableWidgetItem();
+                m_table->setItem(row, col, item);
+            }
+            item->setText(cells[col]);
+            item->setData(Qt::UserRole, ids[row]);
+        }
+    }
+}
+
+void LWRoiWindow::removeSelected()
+{
+    QTableWidgetItem *item = m_table->currentItem();
+    if (item)
+        m_manager->remove(item->data(Qt::UserRole).toInt());
+}
@@ -0,0 +1,184 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#ifndef LW_ROI_H
+#define LW_ROI_H
+
+#include <QList>
+#include <QMainWindow>
+#include <QObject>
+#include <QPen>
+#include <QPolygonF>
+#include <QString>
+#include <QTableWidget>
+#include <QVector>
+
+#include <qwt_plot_item.h>
+#include <qwt_scale_map.h>
+
+#include "lw_common.h"
+#include "lw_data.h"
+#include "lw_profile.h"
+
+
+/// Statistics of a region of interest for one frame.
+struct LWRoiResult {
+    int pixels;
+    double sum;
+    double mean;
+    double min, max;
+    double cx, cy;  // intensity-weighted centroid
+};
+
+
+/// Regions of interest that are evaluated for every new frame.
+///
+/// Rectangles and polygons are rasterized once into spans of pixels sorted
+/// by row, so that all of them are summed in a single pass over the raw
+/// counts of the frame, in parallel bands of rows; a second pass over the
+/// spans fills a histogram per ROI.  Results are kept for the data
+/// generation they were computed for.  Lines are evaluated as width-integrated
+/// profiles through an LWLineProfile each, in displayed values like the
+/// profile window; their centroid is the weighted center along the line.
+class LWRoiManager : public QObject
+{
+    Q_OBJECT
+
+  private:
+    struct Roi {
+        int id;
+        QString name;
+        LWRoiType type;
+        int x1, y1, x2, y2;  // rectangle corners (exclusive), or line ends
+        int width;           // of a line
+        QPolygonF polygon;
+        LWLineProfile *profile;
+        LWRoiResult result;
+        QVector<int> histogram;
+    };
+
+    struct Span {
+        int roi;     // index into m_rois
+        int x0, x1;  // [x0, x1)
+    };
+
+    QList<Roi> m_rois;
+    int m_next_id;
+
+    // spans of all area ROIs, valid for this data size
+    QVector<Span> m_spans;
+    QVector<int> m_row_start;  // first span of each row, height + 1 entries
+    int m_span_width, m_span_height;
+    int m_histogram_bins;
+    int m_generation;  // of the results
+
+    int indexOf(int id) const;
+    int add(const Roi &roi);
+    void buildSpans(int width, int height);
+    void evaluateAreas(const LWData *data);
+    void evaluateLine(const LWData *data, Roi &roi);
+
+  public:
+    LWRoiManager(QObject *parent = NULL);
+    virtual ~LWRoiManager();
+
+    /// Add a rectangle of w x h pixels at (x, y); returns its id.
+    int addRect(int x, int y, int w, int h, const QString &name = QString());
+    /// Add a line profile from (x1, y1) to (x2, y2); returns its id.
+    int addLine(int x1, int y1, int x2, int y2, int width = 1,
+                const QString &name = QString());
+    /// Add a polygon, e.g. from the plot's picker; pixels whose centers
+    /// are inside belong to it.  Returns its id.
+    int addPolygon(const QPolygonF &points, const QString &name = QString());
+    bool remove(int id);
+    void clear();
+
+    int count() const { return m_rois.size(); }
+    QList<int> ids() const;
+    LWRoiType type(int id) const;
+    QString name(int id) const;
+    /// Corners of a rectangle or end points of a line, as x1, y1, x2, y2.
+    QList<int> geometry(int id) const;
+    /// Outline in data coordinates (two points for a line).
+    QPolygonF polygon(int id) const;
+    /// Results of the last update().
+    LWRoiResult result(int id) const;
+    /// Histogram of the raw counts of an area ROI from the last update(),
+    /// with the bins spanning the ROI's minimum to maximum.
+    QList<int> histogram(int id) const;
+    int histogramBins() const { return m_histogram_bins; }
+    /// Number of histogram bins (default 64), 0 to switch them off.
+    void setHistogramBins(int bins);
+    /// Profile of a line ROI from the last update().
+    QVector<double> profile(int id) const;
+
+    /// Evaluate all ROIs on the current layer of "data" and emit
+    /// resultsUpdated().
+    void update(const LWData *data);
+
+  signals:
+    void roisChanged();
+    void resultsUpdated();
+};
+
+
+/// Draws the outlines and names of all ROIs of a manager on the plot.
+class LWRoiItem : public QwtPlotItem
+{
+  private:
+    const LWRoiManager *m_manager;
+    QPen m_pen;
+
+  public:
+    LWRoiItem(const LWRoiManager *manager);
+
+    virtual int rtti() const;
+    virtual void draw(QPainter *painter, const QwtScaleMap &xMap,
+                      const QwtScaleMap &yMap, const QRect &canvasRect) const;
+
+    const QPen &pen() const { return m_pen; }
+    void setPen(const QPen &pen);
+};
+
+
+/// Table of the current results of all ROIs.
+class LWRoiWindow : public QMainWindow
+{
+    Q_OBJECT
+
+  private:
+    LWRoiManager *m_manager;
+    QTableWidget *m_table;
+
+  protected slots:
+    void removeSelected();
+
+  public:
+    LWRoiWindow(QWidget *parent, LWRoiManager *manager);
+    virtual ~LWRoiWindow();
+
+  public slots:
+    void refresh();
+};
+
+#endif
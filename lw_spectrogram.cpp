@@ -0,0 +1,652 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include <QPair>
+#include <QtAlgorithms>
+#include <QtConcurrentRun>
+
+#include <qwt_color_map.h>
+#include <qwt_scale_map.h>
+
+#include "lw_parallel.h"
+#include "lw_pyramid.h"
+#include "lw_spectrogram.h"
+
+
+#define NBINS 65536
+
+
+#define TILE_SIZE 256
+#define TILE_BYTES (TILE_SIZE * TILE_SIZE * sizeof(quint16))
+// missing tiles with more pixels are previewed at every 4th pixel first
+#define PROGRESSIVE_PIXELS (1 << 20)
+#define PREVIEW_STEP 4
+
+
+namespace {
+
+inline int floorDiv(int a, int b)
+{
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+/// Round the mantissa of a scale factor to 32 bits, so that panning (which
+/// moves both ends of the scale) gives the same key for the same zoom.
+double snapScale(double scale)
+{
+    int exp;
+    double mant = frexp(scale, &exp);
+    return ldexp(floor(mant * 4294967296. + 0.5) / 4294967296., exp);
+}
+
+/// Maps between screen pixels and source pixels.  Screen pixels are
+/// counted from the (rounded) screen position of the data origin.
+struct TileGeometry {
+    double xscale, yscale;
+    int width, height;  // of the full resolution data
+    int level;
+
+    /// Source pixel of the screen column/row, or -1 outside of the data.
+    inline int source(int g, double scale, int size) const {
+        double v = floor(g / scale);
+        return (v >= 0 && v < size) ? ((int)v >> level) : -1;
+    }
+    inline int xsource(int gx) const { return source(gx, xscale, width); }
+    inline int ysource(int gy) const { return source(gy, yscale, height); }
+};
+
+struct TileJob {
+    quint16 *bins;
+    int tx, ty;
+};
+
+/// How tiles are quantized into bins.
+struct BinParams {
+    TileGeometry geometry;
+    bool log10;
+    double lower, scale;
+    double outside;  // value of pixels outside of the data
+    int step;        // render every step-th pixel (a power of 2)
+    const QAtomicInt *cancel;  // checked between tiles, if given
+};
+
+/// Quantizes the values of missing tiles into bins, one tile per call.
+template <class T>
+struct TileRenderer {
+    const T *layer;
+    int width;  // of the level
+    BinParams params;
+    quint16 outside;
+    const TileJob *jobs;
+
+    inline quint16 bin(T raw) const {
+        double v = (double)raw;
+        if (params.log10)
+            v = (v > 0) ? ::log10(v) : -1.;
+        return quantize(v);
+    }
+
+    inline quint16 quantize(double v) const {
+        v = (v - params.lower) * params.scale + 0.5;
+        // also catches NaN
+        if (!(v > 0))
+            return 0;
+        if (v >= NBINS - 1)
+            return NBINS - 1;
+        return (quint16)v;
+    }
+
+    void operator()(int begin, int end) const {
+        const TileGeometry &geometry = params.geometry;
+        const int step = params.step;
+        int xsrc[TILE_SIZE];
+        for (int k = begin; k < end; ++k) {
+            if (params.cancel && int(*params.cancel))
+                return;
+            const TileJob &job = jobs[k];
+            for (int i = 0; i < TILE_SIZE; i += step)
+                xsrc[i] = geometry.xsource(job.tx * TILE_SIZE + i);
+            for (int j = 0; j < TILE_SIZE; j += step) {
+                quint16 *line = job.bins + j * TILE_SIZE;
+                int y = geometry.ysource(job.ty * TILE_SIZE + j);
+                if (y < 0) {
+                    for (int i = 0; i < TILE_SIZE; ++i)
+                        line[i] = outside;
+                } else {
+                    const T *row = layer + (size_t)y * width;
+                    for (int i = 0; i < TILE_SIZE; i += step) {
+                        quint16 b = xsrc[i] >= 0 ? bin(row[xsrc[i]]) : outside;
+                        for (int n = 0; n < step; ++n)
+                            line[i + n] = b;
+                    }
+                }
+                // previews repeat the rendered row
+                for (int n = 1; n < step; ++n)
+                    memcpy(line + n * TILE_SIZE, line, TILE_SIZE * sizeof(quint16));
+            }
+        }
+    }
+};
+
+template <class T>
+void renderTiles(const T *layer, int width, const BinParams &params,
+                 const std::vector<TileJob> &jobs)
+{
+    if (jobs.empty())
+        return;
+    TileRenderer<T> renderer;
+    renderer.layer = layer;
+    renderer.width = width;
+    renderer.params = params;
+    renderer.outside = renderer.quantize(params.outside);
+    renderer.jobs = &jobs[0];
+    lwParallelFor(jobs.size(), renderer, 1);
+}
+
+/// Colors a band of image rows from the bins of the visible tiles.
+struct RowComposer {
+    const quint16 *const *tiles;  // row-major grid of visible tiles
+    int tilesPerRow;
+    int gx0, gy0;        // screen pixel of the image origin
+    int tx0, ty0;        // first tile of the grid
+    const QRgb *colors;
+    int columns;
+    uchar *bits;
+    int bytesPerLine;
+
+    void operator()(int begin, int end) const {
+        for (int j = begin; j < end; ++j) {
+            int gy = gy0 + j;
+            int ty = floorDiv(gy, TILE_SIZE);
+            int tj = gy - ty * TILE_SIZE;
+            const quint16 *const *tileRow = tiles + (ty - ty0) * tilesPerRow;
+            QRgb *line = (QRgb *)(bits + (size_t)j * bytesPerLine);
+            int i = 0;
+            while (i < columns) {
+                int gx = gx0 + i;
+                int tx = floorDiv(gx, TILE_SIZE);
+                int ti = gx - tx * TILE_SIZE;
+                int n = qMin(TILE_SIZE - ti, columns - i);
+                const quint16 *src = tileRow[tx - tx0] + tj * TILE_SIZE + ti;
+                for (int k = 0; k < n; ++k)
+                    line[i + k] = colors[src[k]];
+                i += n;
+            }
+        }
+    }
+};
+
+/// True if the keys are for the same data, zoom and level.
+bool sameLevel(const LWTileKey &a, const LWTileKey &b)
+{
+    return a.generation == b.generation && a.layer == b.layer &&
+        a.xscale == b.xscale && a.yscale == b.yscale &&
+        a.level == b.level && a.mode == b.mode;
+}
+
+bool tileUsedBefore(const QPair<unsigned int, LWTileKey> &a,
+                    const QPair<unsigned int, LWTileKey> &b)
+{
+    return a.first < b.first;
+}
+
+}
+
+
+LWColorLut::LWColorLut(const QwtColorMap &map, const QwtDoubleInterval &range,
+                       int size)
+    : QwtColorMap(QwtColorMap::RGB), m_table(qMax(size, 2)), m_range(range)
+{
+    // sample the color map at the center of each table entry
+    double step = range.width() / m_table.size();
+    for (int k = 0; k < m_table.size(); ++k)
+        m_table[k] = map.rgb(range, range.minValue() + (k + 0.5) * step);
+}
+
+LWColorLut::~LWColorLut()
+{
+}
+
+QwtColorMap *LWColorLut::copy() const
+{
+    return new LWColorLut(*this);
+}
+
+QRgb LWColorLut::rgb(const QwtDoubleInterval &interval, double value) const
+{
+    double v = (value - interval.minValue()) * m_table.size() / interval.width();
+    // also catches NaN and empty intervals
+    if (!(v > 0))
+        return m_table[0];
+    if (v >= m_table.size() - 1)
+        return m_table[m_table.size() - 1];
+    return m_table[(int)v];
+}
+
+unsigned char LWColorLut::colorIndex(const QwtDoubleInterval &, double) const
+{
+    return 0;
+}
+
+
+LWRefiner::LWRefiner() : QObject(), m_job(NULL)
+{
+    connect(&m_watcher, SIGNAL(finished()), this, SLOT(jobFinished()));
+}
+
+LWRefiner::~LWRefiner()
+{
+    cancel();
+}
+
+void LWRefiner::start(Job *job)
+{
+    cancel();
+    m_cancel = 0;
+    m_job = job;
+    m_run = QtConcurrent::run(this, &LWRefiner::run, job);
+    m_watcher.setFuture(m_run);
+}
+
+void LWRefiner::cancel()
+{
+    if (!m_job)
+        return;
+    m_cancel = 1;
+    m_run.waitForFinished();
+    delete m_job;
+    m_job = NULL;
+}
+
+LWRefiner::Job *LWRefiner::take()
+{
+    if (!m_job || !m_run.isFinished())
+        return NULL;
+    Job *job = m_job;
+    m_job = NULL;
+    return job;
+}
+
+void LWRefiner::run(Job *job)
+{
+    BinParams params;
+    params.geometry.xscale = job->key.xscale;
+    params.geometry.yscale = job->key.yscale;
+    params.geometry.width = job->width;
+    params.geometry.height = job->height;
+    params.geometry.level = job->key.level;
+    params.log10 = job->log10;
+    params.lower = job->lower;
+    params.scale = job->scale;
+    params.outside = job->outside;
+    params.step = 1;
+    params.cancel = &m_cancel;
+
+    job->bins.resize(job->tiles.size());
+    std::vector<TileJob> jobs(job->tiles.size());
+    for (int k = 0; k < job->tiles.size(); ++k) {
+        job->bins[k].resize(TILE_SIZE * TILE_SIZE);
+        jobs[k].bins = job->bins[k].data();
+        jobs[k].tx = job->tiles[k].x();
+        jobs[k].ty = job->tiles[k].y();
+    }
+    if (!job->floats.isEmpty())
+        renderTiles(job->floats.constData(), job->sourceWidth, params, jobs);
+    else
+        renderTiles(job->ints.constData(), job->sourceWidth, params, jobs);
+}
+
+void LWRefiner::jobFinished()
+{
+    if (m_job && !int(m_cancel))
+        emit refined();
+}
+
+
+LWSpectrogram::LWSpectrogram()
+    : QwtPlotSpectrogram(),
+      m_pyramid_mode(PyramidMax),
+      m_pyramid_level(-1),
+      m_generation(0),
+      m_bins_lower(0),
+      m_bins_step(1),
+      m_renders(0),
+      m_cache_size((size_t)64 << 20),
+      m_progressive(true),
+      m_refiner(new LWRefiner())
+{
+}
+
+LWSpectrogram::~LWSpectrogram()
+{
+    delete m_refiner;
+    clearTiles();
+}
+
+void LWSpectrogram::setPyramidMode(LWPyramidMode mode)
+{
+    m_pyramid_mode = mode;
+    itemChanged();
+}
+
+void LWSpectrogram::setPyramidLevel(int level)
+{
+    m_pyramid_level = level;
+    itemChanged();
+}
+
+void LWSpectrogram::setProgressive(bool on)
+{
+    m_progressive = on;
+    if (!on)
+        m_refiner->cancel();
+    itemChanged();
+}
+
+void LWSpectrogram::setTileCacheSize(int megabytes)
+{
+    m_cache_size = (size_t)qMax(megabytes, 0) << 20;
+    evictTiles();
+}
+
+int LWSpectrogram::pyramidLevelFor(const QwtScaleMap &xMap,
+                                   const QwtScaleMap &yMap) const
+{
+    if (m_pyramid_level >= 0)
+        return m_pyramid_level;
+    // source pixels per screen pixel in the current zoom rectangle; take
+    // the coarsest level whose pixels are not larger than a screen pixel
+    double ratio = qMin(fabs(xMap.sDist() / xMap.pDist()),
+                        fabs(yMap.sDist() / yMap.pDist()));
+    int level = 0;
+    while (ratio >= 2 && level < 30) {
+        ratio /= 2;
+        level++;
+    }
+    return level;
+}
+
+void LWSpectrogram::clearTiles() const
+{
+    qDeleteAll(m_tiles);
+    m_tiles.clear();
+}
+
+void LWSpectrogram::evictTiles() const
+{
+    if ((size_t)m_tiles.size() * TILE_BYTES <= m_cache_size)
+        return;
+    // drop the least recently used tiles down to 3/4 of the budget, but
+    // never the ones of the last render
+    QList<QPair<unsigned int, LWTileKey> > candidates;
+    QHash<LWTileKey, Tile *>::const_iterator it;
+    for (it = m_tiles.constBegin(); it != m_tiles.constEnd(); ++it)
+        if (it.value()->used != m_renders)
+            candidates.append(qMakePair(it.value()->used, it.key()));
+    qSort(candidates.begin(), candidates.end(), tileUsedBefore);
+
+    size_t keep = m_cache_size / TILE_BYTES * 3 / 4;
+    for (int k = 0; k < candidates.size() && (size_t)m_tiles.size() > keep; ++k)
+        delete m_tiles.take(candidates[k].second);
+}
+
+void LWSpectrogram::takeRefined() const
+{
+    LWRefiner::Job *job = m_refiner->take();
+    if (!job)
+        return;
+    // the job was cancelled if the data changed in the meantime
+    LWTileKey key = job->key;
+    for (int k = 0; k < job->tiles.size(); ++k) {
+        key.tx = job->tiles[k].x();
+        key.ty = job->tiles[k].y();
+        Tile *tile = m_tiles.value(key);
+        if (!tile) {
+            tile = new Tile;
+            tile->used = 0;
+            m_tiles.insert(key, tile);
+        }
+        tile->bins = job->bins[k];
+        tile->preview = false;
+    }
+    delete job;
+}
+
+void LWSpectrogram::startRefinement(const LWData *data, const LWTileKey &key,
+                                    const QList<LWPyramidLevel> &levels) const
+{
+    LWRefiner::Job *job = new LWRefiner::Job;
+    job->key = key;
+    job->width = data->width();
+    job->height = data->height();
+    job->log10 = data->isLog10();
+    job->lower = m_bins_lower;
+    job->scale = 1. / m_bins_step;
+    job->outside = job->log10 ? -1. : 0.;
+
+    // the tiles are rendered from a snapshot, since the data may be
+    // replaced before the job is done; most sources are shared, not copied
+    if (key.level > 0) {
+        const LWPyramidLevel &level = levels[key.level - 1];
+        job->sourceWidth = level.width;
+        if (key.mode == PyramidMean)
+            job->floats = level.mean;
+        else
+            job->ints = level.max;
+    } else {
+        job->sourceWidth = data->width();
+        if (!data->logImage().isEmpty()) {
+            job->floats = data->logImage();
+            job->log10 = false;
+        } else {
+            job->ints.resize(data->width() * data->height());
+            memcpy(job->ints.data(), data->currentLayer(),
+                   sizeof(data_t) * job->ints.size());
+        }
+    }
+
+    QHash<LWTileKey, Tile *>::const_iterator it;
+    for (it = m_tiles.constBegin(); it != m_tiles.constEnd(); ++it)
+        if (it.value()->preview && it.value()->used == m_renders)
+            job->tiles.append(QPoint(it.key().tx, it.key().ty));
+    m_refiner->start(job);
+}
+
+QImage LWSpectrogram::renderImage(const QwtScaleMap &xMap,
+                                  const QwtScaleMap &yMap,
+                                  const QwtDoubleRect &area) const
+{
+    const LWRasterData *raster = dynamic_cast<const LWRasterData *>(&data());
+    if (!raster || colorMap().format() != QwtColorMap::RGB ||
+        !raster->lwData()->currentLayer())
+        return QwtPlotSpectrogram::renderImage(xMap, yMap, area);
+    if (area.isEmpty())
+        return QImage();
+
+    // screen pixels per source pixel
+    TileGeometry geometry;
+    geometry.xscale = snapScale((xMap.p2() - xMap.p1()) / (xMap.s2() - xMap.s1()));
+    geometry.yscale = snapScale((yMap.p2() - yMap.p1()) / (yMap.s2() - yMap.s1()));
+    if (!(fabs(geometry.xscale) > 0) || !(fabs(geometry.yscale) > 0) ||
+        fabs(geometry.xscale) > 1e6 || fabs(geometry.yscale) > 1e6)
+        return QwtPlotSpectrogram::renderImage(xMap, yMap, area);
+
+    const LWData *lwdata = raster->lwData();
+    const QRect rect = transform(xMap, yMap, area);
+    QImage image(rect.size(), QImage::Format_ARGB32);
+
+    const QwtDoubleInterval range = raster->range();
+    if (!range.isValid())
+        return image;
+
+    // zoomed out, use a pyramid level as soon as it is built
+    int level = 0;
+    QList<LWPyramidLevel> levels;
+    int wanted = pyramidLevelFor(xMap, yMap);
+    if (wanted > 0 && lwdata->pyramid()->request(lwdata, m_pyramid_mode, levels))
+        level = qMin(wanted, levels.size());
+
+    // new data invalidates all tiles; the bins cover the whole data range,
+    // including the value of pixels outside, and integer counts with a small
+    // range are binned exactly
+    if (lwdata->generation() != m_generation) {
+        m_refiner->cancel();
+        clearTiles();
+        m_generation = lwdata->generation();
+        m_bins_lower = qMin(lwdata->min(), lwdata->isLog10() ? -1. : 0.);
+        m_bins_step = (lwdata->max() - m_bins_lower) / (NBINS - 1);
+        if (!lwdata->isLog10() && m_bins_step < 1)
+            m_bins_step = 1;
+        if (!(m_bins_step > 0))
+            m_bins_step = 1;
+    }
+    m_renders++;
+    takeRefined();
+
+    // the tiles are counted from the screen position of the data origin
+    const int gx0 = rect.left() - qRound(xMap.xTransform(0.));
+    const int gy0 = rect.top() - qRound(yMap.xTransform(0.));
+    const int tx0 = floorDiv(gx0, TILE_SIZE);
+    const int ty0 = floorDiv(gy0, TILE_SIZE);
+    const int ntx = floorDiv(gx0 + rect.width() - 1, TILE_SIZE) - tx0 + 1;
+    const int nty = floorDiv(gy0 + rect.height() - 1, TILE_SIZE) - ty0 + 1;
+
+    LWTileKey key;
+    key.generation = m_generation;
+    key.layer = lwdata->currentZ();
+    key.xscale = geometry.xscale;
+    key.yscale = geometry.yscale;
+    key.level = level;
+    key.mode = level > 0 ? m_pyramid_mode : PyramidOff;
+
+    // a refinement for another zoom is of no use anymore
+    if (m_refiner->hasJob() && !sameLevel(m_refiner->job()->key, key))
+        m_refiner->cancel();
+
+    // look up the visible tiles and collect the missing ones
+    std::vector<const quint16 *> grid(ntx * nty);
+    std::vector<TileJob> jobs;
+    bool previewed = false;
+    for (int ty = 0; ty < nty; ++ty) {
+        for (int tx = 0; tx < ntx; ++tx) {
+            key.tx = tx0 + tx;
+            key.ty = ty0 + ty;
+            Tile *tile = m_tiles.value(key);
+            if (!tile) {
+                tile = new Tile;
+                tile->bins.resize(TILE_SIZE * TILE_SIZE);
+                tile->preview = false;
+                m_tiles.insert(key, tile);
+                TileJob job;
+                job.bins = tile->bins.data();
+                job.tx = key.tx;
+                job.ty = key.ty;
+                jobs.push_back(job);
+            }
+            tile->used = m_renders;
+            previewed = previewed || tile->preview;
+            grid[ty * ntx + tx] = tile->bins.constData();
+        }
+    }
+
+    if (!jobs.empty()) {
+        BinParams params;
+        params.geometry = geometry;
+        params.geometry.width = lwdata->width();
+        params.geometry.height = lwdata->height();
+        params.geometry.level = level;
+        params.log10 = lwdata->isLog10();
+        params.lower = m_bins_lower;
+        params.scale = 1. / m_bins_step;
+        // outside of the data, LWData::value() gives 0 (or its log10)
+        params.outside = params.log10 ? -1. : 0.;
+        params.step = 1;
+        params.cancel = NULL;
+
+        // too much to render at once: show a preview, refine it later
+        if (m_progressive &&
+            jobs.size() * TILE_SIZE * TILE_SIZE > PROGRESSIVE_PIXELS) {
+            params.step = PREVIEW_STEP;
+            for (size_t k = 0; k < jobs.size(); ++k) {
+                key.tx = jobs[k].tx;
+                key.ty = jobs[k].ty;
+                m_tiles.value(key)->preview = true;
+            }
+            previewed = true;
+        }
+
+        if (level == 0 && !lwdata->logImage().isEmpty()) {
+            params.log10 = false;
+            renderTiles(lwdata->logImage().constData(), lwdata->width(),
+                        params, jobs);
+        } else if (level == 0)
+            renderTiles(lwdata->currentLayer(), lwdata->width(), params, jobs);
+        else if (m_pyramid_mode == PyramidMean)
+            renderTiles(levels[level-1].mean.constData(), levels[level-1].width,
+                        params, jobs);
+        else
+            renderTiles(levels[level-1].max.constData(), levels[level-1].width,
+                        params, jobs);
+    }
+
+    if (previewed && !m_refiner->hasJob())
+        startRefinement(lwdata, key, levels);
+
+    // use the plot's color table, or sample the color map ourselves; a new
+    // color range (brightness, contrast...) only needs recoloring
+    const LWColorLut *lut = dynamic_cast<const LWColorLut *>(&colorMap());
+    LWColorLut *ownLut = NULL;
+    if (!lut || lut->range() != range)
+        lut = ownLut = new LWColorLut(colorMap(), range);
+    QVector<QRgb> colors(NBINS);
+    for (int b = 0; b < NBINS; ++b)
+        colors[b] = lut->rgb(range, m_bins_lower + b * m_bins_step);
+    delete ownLut;
+
+    RowComposer composer;
+    composer.tiles = &grid[0];
+    composer.tilesPerRow = ntx;
+    composer.gx0 = gx0;
+    composer.gy0 = gy0;
+    composer.tx0 = tx0;
+    composer.ty0 = ty0;
+    composer.colors = colors.constData();
+    composer.columns = rect.width();
+    // QImage::scanLine() may detach, only touch the bits in the threads
+    composer.bits = image.bits();
+    composer.bytesPerLine = image.bytesPerLine();
+    lwParallelFor(rect.height(), composer);
+
+    evictTiles();
+
+    // mirror the image in case of inverted maps, like Qwt does
+    const bool hInvert = xMap.p1() > xMap.p2();
+    const bool vInvert = yMap.p1() < yMap.p2();
+    if (hInvert || vInvert)
+        image = image.mirrored(hInvert, vInvert);
+    return image;
+}
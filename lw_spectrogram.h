@@ -0,0 +1,229 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#ifndef LW_SPECTROGRAM_H
+#define LW_SPECTROGRAM_H
+
+#include <QAtomicInt>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QObject>
+#include <QPoint>
+#include <QVector>
+
+#include <qwt_color_map.h>
+#include <qwt_double_interval.h>
+#include <qwt_plot_spectrogram.h>
+#include <qwt_scale_map.h>
+
+#include "lw_common.h"
+#include "lw_data.h"
+
+struct LWPyramidLevel;
+
+
+/// Identifies a rendered tile of the spectrogram.  Tiles are aligned to
+/// the screen position of the data origin, so that they stay valid while
+/// panning at the same scale.
+struct LWTileKey {
+    int generation;
+    int layer;
+    double xscale, yscale;  // screen pixels per data pixel
+    int level;
+    LWPyramidMode mode;
+    int tx, ty;
+};
+
+inline bool operator==(const LWTileKey &a, const LWTileKey &b)
+{
+    return a.tx == b.tx && a.ty == b.ty && a.generation == b.generation &&
+        a.layer == b.layer && a.xscale == b.xscale && a.yscale == b.yscale &&
+        a.level == b.level && a.mode == b.mode;
+}
+
+inline uint qHash(const LWTileKey &key)
+{
+    return (uint)key.tx * 7919u ^ (uint)key.ty * 104729u ^
+        (uint)key.generation ^ ((uint)key.level << 24);
+}
+
+
+/// Renders full-resolution tiles in the background while the spectrogram
+/// shows quickly rendered previews.  refined() is emitted when the tiles
+/// of a job are done.
+class LWRefiner : public QObject
+{
+    Q_OBJECT
+
+  public:
+    struct Job {
+        LWTileKey key;          // common part of the tile keys
+        int width, height;      // of the full resolution data
+        bool log10;
+        double lower, scale, outside;
+        // snapshot of the source pixels (of the pyramid level, if any)
+        int sourceWidth;
+        QVector<data_t> ints;   // either these,
+        QVector<float> floats;  // or these are filled
+        QVector<QPoint> tiles;
+        QVector<QVector<quint16> > bins;
+    };
+
+  private:
+    Job *m_job;
+    QFuture<void> m_run;
+    QFutureWatcher<void> m_watcher;
+    QAtomicInt m_cancel;
+
+    void run(Job *job);
+
+  private slots:
+    /// Runs in the GUI thread once the job's future is finished, so that
+    /// take() returns the job when refined() is received.
+    void jobFinished();
+
+  public:
+    LWRefiner();
+    /// Cancels a running job.
+    virtual ~LWRefiner();
+
+    /// True if a job has been started and not been taken yet.
+    bool hasJob() const { return m_job != NULL; }
+    const Job *job() const { return m_job; }
+    void start(Job *job);
+    /// Stop the job (at the next tile) and discard it.
+    void cancel();
+    /// The job if it is finished, to be deleted by the caller, else NULL.
+    Job *take();
+
+  signals:
+    void refined();
+};
+
+
+/// Color map that samples another color map once into a table of colors,
+/// so that mapping a value is a multiplication and a table lookup instead
+/// of the interpolation between color stops.
+class LWColorLut : public QwtColorMap
+{
+  private:
+    QVector<QRgb> m_table;
+    QwtDoubleInterval m_range;
+
+    /// Only RGB format is supported.
+    virtual unsigned char colorIndex(const QwtDoubleInterval &interval,
+                                     double value) const;
+
+  public:
+    /// Sample "map" over "range", usually the current color bar range.
+    LWColorLut(const QwtColorMap &map, const QwtDoubleInterval &range,
+               int size = 4096);
+    virtual ~LWColorLut();
+
+    virtual QwtColorMap *copy() const;
+    virtual QRgb rgb(const QwtDoubleInterval &interval, double value) const;
+
+    const QwtDoubleInterval &range() const { return m_range; }
+    int size() const { return m_table.size(); }
+    const QRgb *table() const { return m_table.constData(); }
+};
+
+
+/// Spectrogram that renders LWRasterData directly from the data buffer.
+///
+/// QwtPlotSpectrogram asks the raster data for every screen pixel through
+/// two virtual calls and then maps the value with the color map.  Here the
+/// source pixel of every screen column is computed once and the rows are
+/// quantized into 16-bit bins in parallel.  The bins are then colored
+/// through a table derived from the color map (the LWColorLut set as color
+/// map, if it matches the range).  When only the color range changes, the
+/// bins of the last render are reused.  Zoomed out, the bins are taken
+/// from a level of the data's LWPyramid instead of the full resolution.
+///
+/// The bins are kept in screen tiles of 256x256 pixels, so that panning
+/// and going back and forth between zoom levels only renders the tiles
+/// that are not cached yet.  All tiles are dropped when the data changes.
+/// If many tiles are missing, they are first rendered from every 4th pixel
+/// and then refined by the LWRefiner in the background; a new frame or zoom
+/// cancels the refinement.
+/// Other raster data and indexed color maps use the generic implementation.
+class LWSpectrogram : public QwtPlotSpectrogram
+{
+  private:
+    LWPyramidMode m_pyramid_mode;
+    int m_pyramid_level;
+
+    struct Tile {
+        QVector<quint16> bins;
+        unsigned int used;  // render count when last used
+        bool preview;       // rendered at reduced resolution
+    };
+
+    // bins are computed over the data range of this generation
+    mutable int m_generation;
+    mutable double m_bins_lower, m_bins_step;
+    mutable QHash<LWTileKey, Tile *> m_tiles;
+    mutable unsigned int m_renders;
+    size_t m_cache_size;
+    bool m_progressive;
+    LWRefiner *m_refiner;
+
+    void clearTiles() const;
+    void evictTiles() const;
+    void takeRefined() const;
+    void startRefinement(const LWData *data, const LWTileKey &key,
+                         const QList<LWPyramidLevel> &levels) const;
+
+  protected:
+    virtual QImage renderImage(const QwtScaleMap &xMap,
+                               const QwtScaleMap &yMap,
+                               const QwtDoubleRect &area) const;
+
+  public:
+    LWSpectrogram();
+    virtual ~LWSpectrogram();
+
+    /// Reduction used for zoomed-out display (default PyramidMax).
+    LWPyramidMode pyramidMode() const { return m_pyramid_mode; }
+    void setPyramidMode(LWPyramidMode mode);
+    /// Pyramid level to display, or -1 (default) to choose it from the
+    /// zoom rectangle.
+    int pyramidLevel() const { return m_pyramid_level; }
+    void setPyramidLevel(int level);
+    /// The pyramid level to display for the given maps.
+    int pyramidLevelFor(const QwtScaleMap &xMap, const QwtScaleMap &yMap) const;
+
+    /// Memory for cached tiles (default 64 MB).
+    void setTileCacheSize(int megabytes);
+
+    /// Show a preview first if rendering takes long (default on).
+    bool isProgressive() const { return m_progressive; }
+    void setProgressive(bool on);
+    /// Emits refined() when previewed tiles are replaced by full ones.
+    LWRefiner *refiner() const { return m_refiner; }
+};
+
+#endif
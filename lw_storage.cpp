@@ -0,0 +1,206 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#include <algorithm>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "lw_storage.h"
+
+
+/** LWStorage *****************************************************************/
+
+size_t LWStorage::s_budget = (size_t)512 * 1024 * 1024;
+
+LWStorage::LWStorage()
+    : m_capacity(2),
+      m_last_z(-1),
+      m_width(0),
+      m_height(0),
+      m_depth(0)
+{
+}
+
+LWStorage::~LWStorage()
+{
+}
+
+void LWStorage::init(int width, int height, int depth)
+{
+    m_width = width;
+    m_height = height;
+    m_depth = depth;
+    // at least the current layer and the one read ahead must fit
+    m_capacity = std::max((size_t)2,
+                          s_budget / std::max((size_t)1, layerSize() * sizeof(data_t)));
+}
+
+const data_t *LWStorage::layer(int z)
+{
+    if (z < 0 || z >= m_depth)
+        return NULL;
+    int step = z - m_last_z;
+    m_last_z = z;
+
+    std::list<Slot>::iterator it = m_slots.begin();
+    while (it != m_slots.end() && it->z != z)
+        ++it;
+
+    if (it == m_slots.end()) {
+        std::vector<data_t> buffer;
+        if (m_slots.size() >= m_capacity) {
+            // evict the least recently used layer, but reuse its buffer
+            release(m_slots.back().z);
+            buffer.swap(m_slots.back().buffer);
+            m_slots.pop_back();
+        }
+        m_slots.push_front(Slot());
+        Slot &slot = m_slots.front();
+        slot.z = z;
+        slot.data = NULL;
+        slot.buffer.swap(buffer);
+        if (!load(z, slot.data, slot.buffer)) {
+            m_slots.pop_front();
+            return NULL;
+        }
+    } else if (it != m_slots.begin()) {
+        m_slots.splice(m_slots.begin(), m_slots, it);
+    }
+
+    // playback: fetch the next layer in stepping direction
+    if ((step == 1 || step == -1) && z + step >= 0 && z + step < m_depth)
+        readAhead(z + step);
+    return m_slots.front().data;
+}
+
+const data_t *LWStorage::peek(int z, std::vector<data_t> &buffer)
+{
+    if (z < 0 || z >= m_depth)
+        return NULL;
+    for (std::list<Slot>::const_iterator it = m_slots.begin();
+         it != m_slots.end(); ++it)
+        if (it->z == z)
+            return it->data;
+    const data_t *data = NULL;
+    if (!load(z, data, buffer))
+        return NULL;
+    return data;
+}
+
+
+/** LWMappedStorage ***********************************************************/
+
+LWMappedStorage::LWMappedStorage(char *map, size_t map_size, size_t offset,
+                                 const std::string &format,
+                                 int width, int height, int depth)
+    : m_map(map),
+      m_map_size(map_size),
+      m_offset(offset),
+      m_format(format),
+      m_itemsize(atoi(format.c_str() + 2)),
+      m_native((format == "<u4" || format == "<i4") &&
+               offset % sizeof(data_t) == 0)
+{
+    init(width, height, depth);
+    // we do our own read-ahead of whole layers
+    madvise(m_map, m_map_size, MADV_RANDOM);
+}
+
+LWMappedStorage::~LWMappedStorage()
+{
+    munmap(m_map, m_map_size);
+}
+
+void LWMappedStorage::advise(int z, int advice, bool inward)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t bytes = layerSize() * m_itemsize;
+    size_t start = m_offset + z * bytes;
+    size_t end = start + bytes;
+    if (inward) {
+        // don't drop pages shared with the neighbouring layers
+        start = (start + page - 1) / page * page;
+        end = end / page * page;
+    } else {
+        start = start / page * page;
+        end = std::min(m_map_size, (end + page - 1) / page * page);
+    }
+    if (end > start)
+        madvise(m_map + start, end - start, advice);
+}
+
+bool LWMappedStorage::load(int z, const data_t *&data, std::vector<data_t> &buffer)
+{
+    const char *src = m_map + m_offset + z * layerSize() * m_itemsize;
+    if (m_native) {
+        data = (const data_t *)src;
+        return true;
+    }
+    buffer.resize(layerSize());
+    if (!LWData::convertBuffer(src, m_format, &buffer[0], layerSize()))
+        return false;
+    data = &buffer[0];
+    // the converted copy is all we need
+    advise(z, MADV_DONTNEED, true);
+    return true;
+}
+
+void LWMappedStorage::release(int z)
+{
+    if (m_native)
+        advise(z, MADV_DONTNEED, true);
+}
+
+void LWMappedStorage::readAhead(int z)
+{
+    advise(z, MADV_WILLNEED, false);
+}
+
+
+/** LWPagedStorage ************************************************************/
+
+LWPagedStorage::LWPagedStorage(LWLayerSource *source)
+    : m_source(source)
+{
+    init(source->width(), source->height(), source->depth());
+}
+
+LWPagedStorage::~LWPagedStorage()
+{
+    delete m_source;
+}
+
+bool LWPagedStorage::load(int z, const data_t *&data, std::vector<data_t> &buffer)
+{
+    buffer.resize(layerSize());
+    if (!m_source->readLayer(z, &buffer[0]))
+        return false;
+    data = &buffer[0];
+    return true;
+}
+
+void LWPagedStorage::readAhead(int z)
+{
+    m_source->prefetch(z);
+}
@@ -0,0 +1,153 @@
+// *****************************************************************************
+// NICOS, the Networked Instrument Control System of the FRM-II
+// Copyright (c) 2009-2014 by the NICOS contributors (see AUTHORS)
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software
+// Foundation; either version 2 of the License, or (at your option) any later
+// version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc.,
+// 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+// Module authors:
+//   Georg Brandl <georg.brandl@frm2.tum.de>
+//
+// *****************************************************************************
+
+#ifndef LW_STORAGE_H
+#define LW_STORAGE_H
+
+#include <stddef.h>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "lw_data.h"
+
+
+/// Interface for readers that deliver a multi-layer dataset one layer at a
+/// time instead of loading it completely.
+class LWLayerSource
+{
+  public:
+    virtual ~LWLayerSource() {}
+
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+    virtual int depth() const = 0;
+    /// Read layer z into dest, which holds width*height values.
+    virtual bool readLayer(int z, data_t *dest) = 0;
+    /// Hint that layer z will probably be requested next.
+    virtual void prefetch(int /*z*/) {}
+};
+
+
+/// Backing store for layer stacks that are too large to keep in memory.
+///
+/// Only a bounded working set of layers is kept resident.  Stepping through
+/// the layers one by one is detected as sequential playback and the next
+/// layer is read ahead; other accesses evict the least recently used layer.
+class LWStorage
+{
+  private:
+    struct Slot {
+        int z;
+        const data_t *data;
+        std::vector<data_t> buffer;
+    };
+    std::list<Slot> m_slots;   // resident layers, most recently used first
+    size_t m_capacity;
+    int m_last_z;
+
+    static size_t s_budget;
+
+  protected:
+    int m_width, m_height, m_depth;
+
+    /// Make layer z available: either point slot.data to it, or read it
+    /// into slot.buffer (which may still hold an evicted layer).
+    virtual bool load(int z, const data_t *&data, std::vector<data_t> &buffer) = 0;
+    /// Called when layer z leaves the working set.
+    virtual void release(int /*z*/) {}
+    /// Called when layer z is expected to be needed soon.
+    virtual void readAhead(int /*z*/) {}
+
+    void init(int width, int height, int depth);
+
+  public:
+    LWStorage();
+    virtual ~LWStorage();
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    int depth() const { return m_depth; }
+    size_t layerSize() const { return (size_t)m_width * m_height; }
+
+    /// Return layer z.  The pointer stays valid until enough other layers
+    /// have been requested to evict it from the working set.
+    const data_t *layer(int z);
+    /// Return layer z without changing the working set or the playback
+    /// detection: a resident layer directly, others read via "buffer".
+    /// A resident layer's pointer is only valid until the next layer().
+    const data_t *peek(int z, std::vector<data_t> &buffer);
+
+    /// Memory used for resident layers of newly opened stacks, in bytes.
+    static void setBudget(size_t bytes) { s_budget = bytes; }
+    static size_t budget() { return s_budget; }
+};
+
+
+/// Layers stored in a memory-mapped file, e.g. a 3D NPY array.  Native
+/// data is used directly from the mapping, with madvise() hints that read
+/// ahead during playback and drop layers that left the working set;
+/// other formats are converted layer by layer.
+class LWMappedStorage : public LWStorage
+{
+  private:
+    char *m_map;
+    size_t m_map_size;
+    size_t m_offset;
+    std::string m_format;
+    size_t m_itemsize;
+    bool m_native;
+
+    void advise(int z, int advice, bool inward);
+
+  protected:
+    virtual bool load(int z, const data_t *&data, std::vector<data_t> &buffer);
+    virtual void release(int z);
+    virtual void readAhead(int z);
+
+  public:
+    /// Takes ownership of the mapping.  The layers start at "offset" and
+    /// are stored in C order with the given (numpy style) format.
+    LWMappedStorage(char *map, size_t map_size, size_t offset,
+                    const std::string &format, int width, int height, int depth);
+    virtual ~LWMappedStorage();
+};
+
+
+/// Layers paged in from a reader such as LWHdf5Source.
+class LWPagedStorage : public LWStorage
+{
+  private:
+    LWLayerSource *m_source;
+
+  protected:
+    virtual bool load(int z, const data_t *&data, std::vector<data_t> &buffer);
+    virtual void readAhead(int z);
+
+  public:
+    /// Takes ownership of the source.
+    LWPagedStorage(LWLayerSource *source);
+    virtual ~LWPagedStorage();
+};
+
+#endif
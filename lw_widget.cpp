@@ -25,18 +25,34 @@
 
 #include <iostream>
 
+#include "lw_export.h"
+#include "lw_integrate.h"
+#include "lw_roi.h"
 #include "lw_widget.h"
 
 
 /** LWWidget ******************************************************************/
 
-LWWidget::LWWidget(QWidget *parent) : QWidget(parent), m_data(NULL)
+LWWidget::LWWidget(QWidget *parent)
+    : QWidget(parent), m_pending(NULL), m_max_frame_rate(0),
+      m_frames_received(0), m_frames_displayed(0), m_frames_dropped(0),
+      m_data(NULL)
 {
     m_instr = INSTR_NONE;
 
+    m_frame_timer = new QTimer(this);
+    m_frame_timer->setSingleShot(true);
+    connect(m_frame_timer, SIGNAL(timeout()), this, SLOT(showPendingData()));
+
     m_plot = new LWPlot(this);
     setStandardColorMap(false, false);
 
+    m_rois = new LWRoiManager(this);
+    m_roi_item = new LWRoiItem(m_rois);
+    m_roi_item->attach(m_plot);
+    connect(m_rois, SIGNAL(roisChanged()), m_plot, SLOT(replot()));
+    m_integrator = new LWRadialIntegrator();
+
     m_controls = new LWControls(this);
 
     QSplitter *splitter = new QSplitter(this);
@@ -51,6 +67,7 @@ LWWidget::LWWidget(QWidget *parent) : QWidget(parent), m_data(NULL)
 LWWidget::~LWWidget()
 {
     unload();
+    delete m_integrator;
 }
 
 void LWWidget::setInstrumentOption(const char *instr)
@@ -67,6 +84,10 @@ void LWWidget::setInstrumentOption(const char *instr)
 
 void LWWidget::unload()
 {
+    if (m_pending) {
+        delete m_pending;
+        m_pending = NULL;
+    }
     if (m_data) {
         delete m_data;
         m_data = NULL;
@@ -103,6 +124,57 @@ void LWWidget::resizeEvent(QResizeEvent *event)
 
 void LWWidget::setData(LWData *data)
 {
+    m_frames_received++;
+    if (m_max_frame_rate <= 0) {
+        showData(data);
+        return;
+    }
+
+    if (m_pending) {
+        delete m_pending;
+        m_frames_dropped++;
+    }
+    m_pending = data;
+
+    if (!m_frame_timer->isActive()) {
+        int interval = (int)(1000. / m_max_frame_rate);
+        int wait = m_last_frame.isValid() ?
+            interval - m_last_frame.elapsed() : 0;
+        if (wait <= 0)
+            showPendingData();
+        else
+            m_frame_timer->start(wait);
+    }
+}
+
+void LWWidget::showPendingData()
+{
+    m_frame_timer->stop();
+    if (m_pending) {
+        LWData *data = m_pending;
+        m_pending = NULL;
+        showData(data);
+    }
+}
+
+void LWWidget::setMaxFrameRate(double fps)
+{
+    m_max_frame_rate = fps;
+    // with the limit lifted, a waiting frame is due now
+    if (fps <= 0)
+        showPendingData();
+}
+
+void LWWidget::resetFrameCounters()
+{
+    m_frames_received = m_frames_displayed = m_frames_dropped = 0;
+}
+
+void LWWidget::showData(LWData *data)
+{
+    m_frames_displayed++;
+    m_last_frame.start();
+
     bool prev_log10 = false;
     bool prev_despeckled = false;
     bool prev_darkfieldsubtracted = false;
@@ -126,7 +198,8 @@ void LWWidget::setData(LWData *data)
             prev_max = m_data->customRangeMax();
         }
 
-        unload();
+        delete m_data;
+        m_data = NULL;
     }
 
     // apply image operations here
@@ -322,29 +395,10 @@ bool LWWidget::controlsVisible() const
 
 void LWWidget::setStandardColorMap(bool grayscale, bool cyclic)
 {
-    if (grayscale) {
-        QwtLinearColorMap colorMap(Qt::black, Qt::white);
-        m_plot->setColorMap(colorMap);
+    QwtLinearColorMap colorMap = LWExporter::standardColorMap(grayscale, cyclic);
+    m_plot->setColorMap(colorMap);
+    if (grayscale)
         m_controls->grayscaleBox->setChecked(true);
-    } else {
-        if (cyclic) {
-            // e.g. for phase (0..2pi) display
-            QwtLinearColorMap colorMap(Qt::blue, Qt::blue);
-            colorMap.addColorStop(0.0, Qt::blue);
-            colorMap.addColorStop(0.75, Qt::red);
-            colorMap.addColorStop(0.5, Qt::yellow);
-            colorMap.addColorStop(0.25, Qt::cyan);
-            colorMap.addColorStop(1.0, Qt::blue);
-            m_plot->setColorMap(colorMap);
-        } else {
-            QwtLinearColorMap colorMap(Qt::blue, Qt::red);
-            colorMap.addColorStop(0.0, Qt::blue);
-            colorMap.addColorStop(0.33, Qt::cyan);
-            colorMap.addColorStop(0.66, Qt::yellow);
-            colorMap.addColorStop(1.0, Qt::red);
-            m_plot->setColorMap(colorMap);
-        }
-    }
     updateGraph(false);
 }
 
@@ -355,11 +409,33 @@ void LWWidget::setAxisLabels(const char *xaxis, const char *yaxis)
     m_controls->setAxisNames(xaxis, yaxis);
 }
 
+LWPyramidMode LWWidget::pyramidMode() const
+{
+    return m_plot->pyramidMode();
+}
+
+void LWWidget::setPyramidMode(LWPyramidMode mode)
+{
+    m_plot->setPyramidMode(mode);
+}
+
+int LWWidget::pyramidLevel() const
+{
+    return m_plot->pyramidLevel();
+}
+
+void LWWidget::setPyramidLevel(int level)
+{
+    m_plot->setPyramidLevel(level);
+}
+
 void LWWidget::setCustomRange(double lower, double upper)
 {
     if (m_data) {
         m_data->setCustomRange(lower, upper);
-        updateGraph(false);
+        // the data is unchanged, the plot only needs to be recolored
+        m_plot->updateRange();
+        m_plot->replot();
     }
 }
 
@@ -369,8 +445,10 @@ void LWWidget::updateGraph(bool newdata)
         m_plot->setData(new LWRasterData(m_data));
 
         updateLabels();
-        if (newdata)
+        if (newdata) {
+            m_rois->update(m_data);
             emit dataUpdated(m_data);
+        }
     }
 }
 
@@ -386,6 +464,11 @@ void LWWidget::hideProfileLine()
     m_controls->hideProfileLine();
 }
 
+void LWWidget::showIntegration()
+{
+    m_controls->showIntegration();
+}
+
 void LWWidget::setControls(LWCtrl which)
 {
     m_controls->setControls(which);
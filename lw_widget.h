@@ -26,6 +26,12 @@
 #define LW_WIDGET_H
 
 class LWControls;
+class LWRadialIntegrator;
+class LWRoiItem;
+class LWRoiManager;
+
+#include <QTime>
+#include <QTimer>
 
 #include "lw_plot.h"
 #include "lw_controls.h"
@@ -48,10 +54,24 @@ class LWWidget : public QWidget
     void *m_instr_data;
     void unload();
 
+    // live update rate limiting
+    LWData *m_pending;  // newest frame not shown yet
+    QTimer *m_frame_timer;
+    QTime m_last_frame;
+    double m_max_frame_rate;
+    int m_frames_received;
+    int m_frames_displayed;
+    int m_frames_dropped;
+
+    void showData(LWData *data);
+
   protected:
     LWData *m_data;
     LWPlot *m_plot;
     LWControls *m_controls;
+    LWRoiManager *m_rois;
+    LWRoiItem *m_roi_item;
+    LWRadialIntegrator *m_integrator;
 
     bool m_showgrid;
     bool m_log10;
@@ -71,10 +91,29 @@ class LWWidget : public QWidget
     int instrument();
 
     LWPlot *plot() { return m_plot; }
+    /// Regions of interest, evaluated for every new frame and drawn on
+    /// the plot.
+    LWRoiManager *roiManager() { return m_rois; }
+    /// Radial/azimuthal integration shown by showIntegration().
+    LWRadialIntegrator *integrator() { return m_integrator; }
 
+    /// The displayed data; a frame waiting for display is not included.
     LWData *data() { return m_data; }
+    /// Display new data, taking ownership.  With a maximum frame rate set,
+    /// frames arriving faster are coalesced: only the newest waiting frame
+    /// is kept and displayed when the next frame is due.
     void setData(LWData *data);
 
+    /// Maximum number of displayed frames per second, 0 (default) for no
+    /// limit.
+    double maxFrameRate() const { return m_max_frame_rate; }
+    void setMaxFrameRate(double fps);
+    int framesReceived() const { return m_frames_received; }
+    int framesDisplayed() const { return m_frames_displayed; }
+    /// Frames replaced by a newer one before they were displayed.
+    int framesDropped() const { return m_frames_dropped; }
+    void resetFrameCounters();
+
     bool hasGrid() const;
     bool isLog10() const;
     bool isKeepAspect() const;
@@ -90,6 +129,11 @@ class LWWidget : public QWidget
     void setStandardColorMap(bool grayscale, bool cyclic);
     void setAxisLabels(const char *xaxis, const char *yaxis);
 
+    LWPyramidMode pyramidMode() const;
+    void setPyramidMode(LWPyramidMode mode);
+    int pyramidLevel() const;
+    void setPyramidLevel(int level);
+
   public slots:
     void setGrid(bool val);
     void setLog10(bool val);
@@ -105,9 +149,14 @@ class LWWidget : public QWidget
     void setControlsVisible(bool val);
     void setControls(LWCtrl which);
     void hideProfileLine();
+    /// Show the integrator's curve for the current data in the profile
+    /// window; it follows new frames until another profile is chosen.
+    void showIntegration();
 
     void updateGraph(bool newdata=true);
     void updateLabels();
+    /// Display a waiting frame now.
+    void showPendingData();
 
   signals:
     void dataUpdated(LWData *data);
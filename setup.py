@@ -66,10 +66,14 @@ class moc_build_ext(sip_build_ext):
         return ret
 
 
+hdf5_include_dirs = []
+hdf5_lib = "hdf5"
+
 if sys.platform == 'darwin':
     extra_include_dirs = ["/usr/local/qwt/include", "/usr/local/cfitsio/include"]
     extra_libs = ["qwt", "cfitsio", "tiff"]
     extra_lib_dirs = ["/usr/local/qwt/lib", "/usr/local/cfitsio/lib"]
+    hdf5_include_dirs = ["/usr/local/include"]
 else:
     extra_lib_dirs = []
     dist = platform.linux_distribution()[0].strip()  # old openSUSE appended a space here :(
@@ -82,6 +86,8 @@ else:
     elif dist in ['Ubuntu', 'LinuxMint', 'debian',]:
         extra_include_dirs = ["/usr/include/qwt-qt4", "/usr/include/qwt"]
         extra_libs = ["qwt-qt4", "cfitsio", "tiff"]
+        hdf5_include_dirs = ["/usr/include/hdf5/serial"]
+        hdf5_lib = "hdf5_serial"
     elif dist == 'CentOS':
         extra_include_dirs = ["/usr/local/qwt5/include"]
         extra_libs = ["qwt", "cfitsio", "tiff"]
@@ -116,6 +122,16 @@ if not devfits or not devtiff:
         conf.warn("Please install developer files of the 'tiff' library.")
     sys.exit(1)
 
+# HDF5 is optional: without it, NeXus/HDF5 files cannot be read
+define_macros = []
+if conf.check_header('hdf5.h', extra_include_dirs + hdf5_include_dirs):
+    extra_include_dirs.extend(hdf5_include_dirs)
+    extra_libs.append(hdf5_lib)
+    define_macros.append(('HAVE_HDF5', 1))
+else:
+    conf.warn("Developer files of the 'hdf5' library not found, "
+              "building without NeXus/HDF5 support.")
+
 setup(
     name='nicoslivewidget',
     version=get_git_version().lstrip('v'),
@@ -125,6 +141,7 @@ setup(
                   include_dirs=['.'] + extra_include_dirs,
                   library_dirs=extra_lib_dirs,
                   libraries=extra_libs,
+                  define_macros=define_macros,
                   ),
     ],
     cmdclass={'build_ext': moc_build_ext}